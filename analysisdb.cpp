@@ -0,0 +1,386 @@
+/**
+ * @file
+ *
+ * @brief On disk cache of analysis results for an executable.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#include "analysisdb.h"
+#include "codeindex.h"
+#include "function.h"
+#include "hash.h"
+#include "normalize.h"
+#include "parallel.h"
+#include <Zydis/Zydis.h>
+#include <algorithm>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace
+{
+const char s_magic[8] = {'U', 'N', 'A', 'S', 'M', 'D', 'B', '\0'};
+
+// All values are stored in host byte order, which is little endian on every platform the tool targets.
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t section_count;
+    uint64_t binary_hash;
+    uint64_t config_hash;
+    uint32_t mnemonic_count; // Instructions store Zydis mnemonics, another Zydis version numbers them differently.
+    uint32_t reserved;
+};
+
+struct SectionHeader
+{
+    uint32_t id;
+    uint32_t element_size;
+    uint64_t offset; // From the start of the file, 8 byte aligned.
+    uint64_t count;
+};
+
+enum SectionIds
+{
+    SECTION_FUNCTIONS,
+    SECTION_FLOW_STARTS,
+    SECTION_FLOW,
+    SECTION_TABLE_STARTS,
+    SECTION_TABLES,
+    SECTION_FINGERPRINTS,
+    SECTION_LABEL_STARTS,
+    SECTION_LABELS,
+    SECTION_REFERENCE_STARTS,
+    SECTION_REFERENCES,
+    SECTION_CONSTANT_STARTS,
+    SECTION_CONSTANTS,
+    SECTION_INSTRUCTIONS,
+    SECTION_OPERANDS,
+    SECTION_COUNT,
+};
+
+struct SectionData
+{
+    const void *data;
+    uint32_t element_size;
+    uint64_t count;
+};
+
+template<typename T>
+SectionData section_data(const std::vector<T> &values)
+{
+    return {values.data(), uint32_t(sizeof(T)), values.size()};
+}
+
+template<typename T>
+void flatten(const std::vector<std::vector<T>> &lists, std::vector<uint32_t> &starts, std::vector<T> &values)
+{
+    starts.clear();
+    values.clear();
+    starts.reserve(lists.size() + 1);
+
+    for (auto it = lists.begin(); it != lists.end(); ++it) {
+        starts.push_back(uint32_t(values.size()));
+        values.insert(values.end(), it->begin(), it->end());
+    }
+
+    starts.push_back(uint32_t(values.size()));
+}
+
+template<typename T>
+bool read_section(const uint8_t *file, uint64_t file_size, const SectionHeader *sections, uint32_t section_count,
+    uint32_t id, std::vector<T> &values)
+{
+    for (uint32_t i = 0; i < section_count; ++i) {
+        const SectionHeader &section = sections[i];
+
+        if (section.id != id) {
+            continue;
+        }
+
+        if (section.element_size != sizeof(T) || section.offset > file_size
+            || section.count > (file_size - section.offset) / sizeof(T)) {
+            return false;
+        }
+
+        values.resize(section.count);
+        memcpy(values.data(), file + section.offset, section.count * sizeof(T));
+
+        return true;
+    }
+
+    return false;
+}
+
+bool valid_starts(const std::vector<uint32_t> &starts, size_t function_count, size_t value_count)
+{
+    if (starts.size() != function_count + 1 || starts.back() != value_count) {
+        return false;
+    }
+
+    return std::is_sorted(starts.begin(), starts.end());
+}
+
+// Operand ranges and mnemonics have to stay inside their arrays, lookups and the bigram table index them unchecked.
+bool valid_instructions(const std::vector<unassemblize::CodeIndex::Instruction> &instructions, size_t operand_count)
+{
+    for (auto it = instructions.begin(); it != instructions.end(); ++it) {
+        if (uint64_t(it->first_operand) + it->operand_count > operand_count || it->mnemonic > ZYDIS_MNEMONIC_MAX_VALUE) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const char *find_section_name(const unassemblize::Executable &exe, uint64_t address)
+{
+    for (auto it = exe.sections().begin(); it != exe.sections().end(); ++it) {
+        if (address >= it->second.address && address < it->second.address + it->second.size) {
+            return it->first.c_str();
+        }
+    }
+
+    return nullptr;
+}
+} // namespace
+
+uint64_t unassemblize::AnalysisDatabase::hash_file(const char *file_name)
+{
+    FILE *fp = fopen(file_name, "rb");
+    uint64_t hash = FNV1A_64_OFFSET;
+
+    if (fp == nullptr) {
+        return 0;
+    }
+
+    std::vector<uint8_t> buffer(1024 * 1024);
+    size_t read;
+
+    while ((read = fread(buffer.data(), 1, buffer.size(), fp)) != 0) {
+        hash = fnv1a_64(buffer.data(), read, hash);
+    }
+
+    fclose(fp);
+
+    return hash;
+}
+
+void unassemblize::AnalysisDatabase::build(Executable &exe, uint64_t binary_hash, uint64_t config_hash)
+{
+    m_binaryHash = binary_hash;
+    m_configHash = config_hash;
+    m_functions = exe.functions();
+    const size_t count = m_functions.size();
+    std::vector<std::vector<Function::InstructionInfo>> flow(count);
+    std::vector<std::vector<Function::JumpTable>> tables(count);
+    std::vector<std::vector<uint64_t>> labels(count);
+    std::vector<std::vector<Reference>> references(count);
+    std::vector<std::vector<Constant>> constants(count);
+
+    m_fingerprints.assign(count, {0, 0});
+
+    // Analysis only reads the executable, the labels aren't added as symbols until apply.
+    parallel_for(count, [&](size_t i) {
+        const Executable::FunctionEntry &entry = m_functions[i];
+        const char *section_name = find_section_name(exe, entry.start);
+        m_fingerprints[i] = function_fingerprint(exe, entry.start, entry.end);
+
+        if (section_name == nullptr || entry.end <= entry.start) {
+            return;
+        }
+
+        Function func(exe, section_name, entry.start, entry.end - 1);
+        func.analyse();
+        flow[i] = func.instructions();
+        tables[i] = func.jump_tables();
+
+        for (auto it = func.labels().begin(); it != func.labels().end(); ++it) {
+            labels[i].push_back(it->first);
+        }
+    });
+
+    CodeIndex code;
+    code.build(exe);
+
+    // The index is sorted by target and value, the database keeps it per function like everything else.
+    for (auto it = code.references().begin(); it != code.references().end(); ++it) {
+        size_t i = function_index(it->function);
+
+        if (i != SIZE_MAX) {
+            references[i].push_back({it->target, it->address});
+        }
+    }
+
+    for (auto it = code.constants().begin(); it != code.constants().end(); ++it) {
+        size_t i = function_index(it->function);
+
+        if (i != SIZE_MAX) {
+            constants[i].push_back({it->value, it->address});
+        }
+    }
+
+    flatten(flow, m_flowStarts, m_flow);
+    flatten(tables, m_tableStarts, m_tables);
+    flatten(labels, m_labelStarts, m_labels);
+    flatten(references, m_referenceStarts, m_references);
+    flatten(constants, m_constantStarts, m_constants);
+    m_instructions = code.instructions();
+    m_operands = code.operands();
+}
+
+bool unassemblize::AnalysisDatabase::save(const char *file_name) const
+{
+    FILE *fp = fopen(file_name, "wb");
+
+    if (fp == nullptr) {
+        return false;
+    }
+
+    const SectionData data[SECTION_COUNT] = {
+        section_data(m_functions),
+        section_data(m_flowStarts),
+        section_data(m_flow),
+        section_data(m_tableStarts),
+        section_data(m_tables),
+        section_data(m_fingerprints),
+        section_data(m_labelStarts),
+        section_data(m_labels),
+        section_data(m_referenceStarts),
+        section_data(m_references),
+        section_data(m_constantStarts),
+        section_data(m_constants),
+        section_data(m_instructions),
+        section_data(m_operands),
+    };
+
+    FileHeader header;
+    memcpy(header.magic, s_magic, sizeof(header.magic));
+    header.version = DATABASE_VERSION;
+    header.section_count = SECTION_COUNT;
+    header.binary_hash = m_binaryHash;
+    header.config_hash = m_configHash;
+    header.mnemonic_count = ZYDIS_MNEMONIC_MAX_VALUE + 1;
+    header.reserved = 0;
+
+    SectionHeader sections[SECTION_COUNT];
+    uint64_t offset = sizeof(FileHeader) + sizeof(sections);
+
+    for (uint32_t i = 0; i < SECTION_COUNT; ++i) {
+        sections[i].id = i;
+        sections[i].element_size = data[i].element_size;
+        sections[i].offset = offset;
+        sections[i].count = data[i].count;
+        offset += (data[i].count * data[i].element_size + 7) & ~uint64_t(7);
+    }
+
+    static const uint8_t padding[8] = {0};
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(sections, sizeof(sections), 1, fp) == 1;
+
+    for (uint32_t i = 0; i < SECTION_COUNT && ok; ++i) {
+        size_t size = data[i].count * data[i].element_size;
+        size_t pad = (8 - size % 8) % 8;
+        ok = fwrite(data[i].data, 1, size, fp) == size && fwrite(padding, 1, pad, fp) == pad;
+    }
+
+    return fclose(fp) == 0 && ok;
+}
+
+bool unassemblize::AnalysisDatabase::load(const char *file_name, uint64_t binary_hash, uint64_t config_hash)
+{
+    FILE *fp = fopen(file_name, "rb");
+
+    if (fp == nullptr) {
+        return false;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    // Read into 8 byte words so the arrays are as aligned as they would be when mapped.
+    std::vector<uint64_t> buffer((size > 0 ? size + 7 : 0) / 8);
+    bool ok = size >= long(sizeof(FileHeader)) && fread(buffer.data(), 1, size, fp) == size_t(size);
+    fclose(fp);
+
+    if (!ok) {
+        return false;
+    }
+
+    const uint8_t *file = reinterpret_cast<const uint8_t *>(buffer.data());
+    FileHeader header;
+    memcpy(&header, file, sizeof(header));
+
+    if (memcmp(header.magic, s_magic, sizeof(s_magic)) != 0 || header.version != DATABASE_VERSION
+        || header.binary_hash != binary_hash || header.config_hash != config_hash
+        || header.mnemonic_count != ZYDIS_MNEMONIC_MAX_VALUE + 1
+        || header.section_count > (size - sizeof(FileHeader)) / sizeof(SectionHeader)) {
+        return false;
+    }
+
+    const SectionHeader *sections = reinterpret_cast<const SectionHeader *>(file + sizeof(FileHeader));
+    const uint32_t count = header.section_count;
+    ok = read_section(file, size, sections, count, SECTION_FUNCTIONS, m_functions)
+        && read_section(file, size, sections, count, SECTION_FLOW_STARTS, m_flowStarts)
+        && read_section(file, size, sections, count, SECTION_FLOW, m_flow)
+        && read_section(file, size, sections, count, SECTION_TABLE_STARTS, m_tableStarts)
+        && read_section(file, size, sections, count, SECTION_TABLES, m_tables)
+        && read_section(file, size, sections, count, SECTION_FINGERPRINTS, m_fingerprints)
+        && read_section(file, size, sections, count, SECTION_LABEL_STARTS, m_labelStarts)
+        && read_section(file, size, sections, count, SECTION_LABELS, m_labels)
+        && read_section(file, size, sections, count, SECTION_REFERENCE_STARTS, m_referenceStarts)
+        && read_section(file, size, sections, count, SECTION_REFERENCES, m_references)
+        && read_section(file, size, sections, count, SECTION_CONSTANT_STARTS, m_constantStarts)
+        && read_section(file, size, sections, count, SECTION_CONSTANTS, m_constants)
+        && read_section(file, size, sections, count, SECTION_INSTRUCTIONS, m_instructions)
+        && read_section(file, size, sections, count, SECTION_OPERANDS, m_operands)
+        && valid_starts(m_flowStarts, m_functions.size(), m_flow.size())
+        && valid_starts(m_tableStarts, m_functions.size(), m_tables.size())
+        && m_fingerprints.size() == m_functions.size()
+        && std::is_sorted(m_functions.begin(),
+            m_functions.end(),
+            [](const Executable::FunctionEntry &a, const Executable::FunctionEntry &b) { return a.start < b.start; })
+        && valid_starts(m_labelStarts, m_functions.size(), m_labels.size())
+        && valid_starts(m_referenceStarts, m_functions.size(), m_references.size())
+        && valid_starts(m_constantStarts, m_functions.size(), m_constants.size())
+        && valid_instructions(m_instructions, m_operands.size());
+
+    if (!ok) {
+        *this = AnalysisDatabase();
+        return false;
+    }
+
+    m_binaryHash = binary_hash;
+    m_configHash = config_hash;
+
+    return true;
+}
+
+size_t unassemblize::AnalysisDatabase::function_index(uint64_t start) const
+{
+    auto func = std::lower_bound(m_functions.begin(),
+        m_functions.end(),
+        start,
+        [](const Executable::FunctionEntry &entry, uint64_t address) { return entry.start < address; });
+
+    return func != m_functions.end() && func->start == start ? size_t(func - m_functions.begin()) : SIZE_MAX;
+}
+
+void unassemblize::AnalysisDatabase::apply(Executable &exe) const
+{
+    exe.set_functions(m_functions);
+    exe.set_analysis(this);
+    exe.recover_symbols();
+
+    for (auto it = m_labels.begin(); it != m_labels.end(); ++it) {
+        char name[32];
+        snprintf(name, sizeof(name), "loc_%" PRIx64, *it);
+        exe.add_symbol(name, *it);
+    }
+}
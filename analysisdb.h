@@ -0,0 +1,126 @@
+/**
+ * @file
+ *
+ * @brief On disk cache of analysis results for an executable.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#pragma once
+
+#include "codeindex.h"
+#include "executable.h"
+#include "function.h"
+#include "normalize.h"
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+namespace unassemblize
+{
+/**
+ * Function table, instruction streams, jump tables, labels, fingerprints, references and constants of every function
+ * and the decoded instruction index, so a later run can skip function discovery, dissassembly skips the label pass,
+ * folding and comparing skip normalizing and reference, constant and instruction queries skip decoding.
+ * The file is a header, a section directory and 8 byte aligned arrays of fixed size records so it can be mapped and
+ * used in place. Per function data is stored as CSR, a start index per function into one flat array.
+ */
+class AnalysisDatabase
+{
+public:
+    enum
+    {
+        DATABASE_VERSION = 7,
+    };
+
+    struct Reference
+    {
+        uint64_t target; // Address within the image the operand refers to.
+        uint64_t address; // Address of the referencing instruction.
+    };
+
+    struct Constant
+    {
+        uint64_t value; // Immediate or displacement, truncated to the pointer size.
+        uint64_t address; // Address of the instruction using it.
+    };
+
+public:
+    /**
+     * FNV-1a hash of a file's contents, used to tie a database to the binary and config it was built from. Returns 0
+     * for a file that can't be read so a missing config has a stable hash too.
+     */
+    static uint64_t hash_file(const char *file_name);
+    /**
+     * Analyses every function in the executable's function table in parallel.
+     */
+    void build(Executable &exe, uint64_t binary_hash, uint64_t config_hash);
+    bool save(const char *file_name) const;
+    /**
+     * Loads a database, fails if it can't be read, is of another version or was built for a different binary or
+     * config. Config symbols seed function discovery, so a changed config needs a fresh build.
+     */
+    bool load(const char *file_name, uint64_t binary_hash, uint64_t config_hash);
+    /**
+     * Installs the function table and labels into the executable and recovers the RTTI symbols, replaces
+     * discover_functions. The executable keeps a pointer to the database for dissassembly, so it has to outlive its use.
+     */
+    void apply(Executable &exe) const;
+    const std::vector<Executable::FunctionEntry> &functions() const { return m_functions; }
+    /**
+     * Index of the function starting at start, SIZE_MAX if there is none.
+     */
+    size_t function_index(uint64_t start) const;
+    /**
+     * Instruction stream and jump tables as Function::analyse left them, to seed a Function with.
+     */
+    std::pair<const Function::InstructionInfo *, const Function::InstructionInfo *> flow(size_t function) const
+    {
+        return {m_flow.data() + m_flowStarts[function], m_flow.data() + m_flowStarts[function + 1]};
+    }
+    std::pair<const Function::JumpTable *, const Function::JumpTable *> jump_tables(size_t function) const
+    {
+        return {m_tables.data() + m_tableStarts[function], m_tables.data() + m_tableStarts[function + 1]};
+    }
+    const FunctionFingerprint &fingerprint(size_t function) const { return m_fingerprints[function]; }
+    std::pair<const uint64_t *, const uint64_t *> labels(size_t function) const
+    {
+        return {m_labels.data() + m_labelStarts[function], m_labels.data() + m_labelStarts[function + 1]};
+    }
+    std::pair<const Reference *, const Reference *> references(size_t function) const
+    {
+        return {m_references.data() + m_referenceStarts[function], m_references.data() + m_referenceStarts[function + 1]};
+    }
+    std::pair<const Constant *, const Constant *> constants(size_t function) const
+    {
+        return {m_constants.data() + m_constantStarts[function], m_constants.data() + m_constantStarts[function + 1]};
+    }
+    /**
+     * Instruction index of the CodeIndex the database was built with, see CodeIndex for the layout.
+     */
+    const std::vector<CodeIndex::Instruction> &instructions() const { return m_instructions; }
+    const std::vector<CodeIndex::Operand> &operands() const { return m_operands; }
+
+private:
+    std::vector<Executable::FunctionEntry> m_functions;
+    std::vector<uint32_t> m_flowStarts; // Function count + 1 entries.
+    std::vector<Function::InstructionInfo> m_flow;
+    std::vector<uint32_t> m_tableStarts;
+    std::vector<Function::JumpTable> m_tables;
+    std::vector<FunctionFingerprint> m_fingerprints; // One per function.
+    std::vector<uint32_t> m_labelStarts;
+    std::vector<uint64_t> m_labels;
+    std::vector<uint32_t> m_referenceStarts;
+    std::vector<Reference> m_references;
+    std::vector<uint32_t> m_constantStarts;
+    std::vector<Constant> m_constants;
+    std::vector<CodeIndex::Instruction> m_instructions;
+    std::vector<CodeIndex::Operand> m_operands;
+    uint64_t m_binaryHash = 0;
+    uint64_t m_configHash = 0;
+};
+} // namespace unassemblize
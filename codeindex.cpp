@@ -0,0 +1,257 @@
+/**
+ * @file
+ *
+ * @brief Index built from decoding every function in the function table.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#include "codeindex.h"
+#include "analysisdb.h"
+#include "executable.h"
+#include "parallel.h"
+#include "scan.h"
+#include <Zydis/Zydis.h>
+#include <algorithm>
+
+void unassemblize::CodeIndex::build(const Executable &exe)
+{
+    const std::vector<Executable::FunctionEntry> &functions = exe.functions();
+    std::vector<std::vector<Reference>> function_refs(functions.size());
+    std::vector<std::vector<Constant>> function_consts(functions.size());
+    std::vector<std::vector<Instruction>> function_instructions(functions.size());
+    std::vector<std::vector<Operand>> function_operands(functions.size());
+    const bool is_64 = exe.pointer_size() == sizeof(uint64_t);
+    const uint64_t image_low = exe.base_address();
+    const uint64_t image_high = exe.end_address();
+    const uint64_t value_mask = is_64 ? UINT64_MAX : UINT32_MAX;
+    m_valueMask = value_mask;
+
+    parallel_for(functions.size(), [&](size_t i) {
+        const Executable::FunctionEntry &func = functions[i];
+        const Executable::SectionInfo *section = exe.find_section(func.start);
+
+        if (section == nullptr || func.end > section->address + section->size) {
+            return;
+        }
+
+        ZydisDecoder decoder;
+        ZydisDecodedInstruction instruction;
+        ZydisDecodedOperand operands[ZYDIS_MAX_OPERAND_COUNT];
+        ZydisDecoderInit(&decoder,
+            is_64 ? ZYDIS_MACHINE_MODE_LONG_64 : ZYDIS_MACHINE_MODE_LEGACY_32,
+            is_64 ? ZYDIS_STACK_WIDTH_64 : ZYDIS_STACK_WIDTH_32);
+        const uint8_t *data = section->data + (func.start - section->address);
+        const uint64_t size = func.end - func.start;
+        std::vector<Reference> &refs = function_refs[i];
+        std::vector<Constant> &consts = function_consts[i];
+        std::vector<Instruction> &insns = function_instructions[i];
+        std::vector<Operand> &ops = function_operands[i];
+
+        for (uint64_t offset = 0; offset < size;) {
+            if (ZYAN_FAILED(ZydisDecoderDecodeFull(&decoder, data + offset, size - offset, &instruction, operands))) {
+                ++offset;
+                continue;
+            }
+
+            const uint64_t runtime_address = func.start + offset;
+            // Operand indices are made global when the per function arrays are concatenated.
+            insns.push_back({runtime_address,
+                uint32_t(ops.size()),
+                uint16_t(instruction.mnemonic),
+                instruction.operand_count_visible,
+                uint8_t(offset == 0)});
+
+            for (uint8_t op = 0; op < instruction.operand_count_visible; ++op) {
+                const ZydisDecodedOperand &operand = operands[op];
+                uint64_t target = 0;
+                Operand record = {0, ZYDIS_REGISTER_NONE, ZYDIS_REGISTER_NONE, uint8_t(operand.type), 0};
+
+                if (operand.type == ZYDIS_OPERAND_TYPE_REGISTER) {
+                    record.reg = operand.reg.value;
+                } else if (operand.type == ZYDIS_OPERAND_TYPE_MEMORY) {
+                    record.value = operand.mem.disp.value;
+                    record.reg = operand.mem.base;
+                    record.index = operand.mem.index;
+                    record.scale = operand.mem.scale;
+                }
+
+                if (operand.type == ZYDIS_OPERAND_TYPE_IMMEDIATE) {
+                    if (operand.imm.is_relative) {
+                        ZydisCalcAbsoluteAddress(&instruction, &operand, runtime_address, &target);
+                    } else {
+                        target = operand.imm.value.u & value_mask;
+                        consts.push_back({target, func.start, runtime_address});
+                    }
+                } else if (operand.type == ZYDIS_OPERAND_TYPE_MEMORY) {
+                    if (operand.mem.base == ZYDIS_REGISTER_RIP || operand.mem.base == ZYDIS_REGISTER_EIP) {
+                        ZydisCalcAbsoluteAddress(&instruction, &operand, runtime_address, &target);
+                    } else {
+                        target = uint64_t(operand.mem.disp.value) & value_mask;
+
+                        if (target != 0) {
+                            consts.push_back({target, func.start, runtime_address});
+                        }
+                    }
+                } else if (operand.type == ZYDIS_OPERAND_TYPE_POINTER) {
+                    target = operand.ptr.offset;
+                }
+
+                if (operand.type == ZYDIS_OPERAND_TYPE_IMMEDIATE || operand.type == ZYDIS_OPERAND_TYPE_POINTER) {
+                    record.value = target;
+                }
+
+                ops.push_back(record);
+
+                if (target >= image_low && target < image_high) {
+                    refs.push_back({target, func.start, runtime_address});
+                }
+            }
+
+            offset += instruction.length;
+
+            // Step over inline jump tables the same way Function::disassemble does.
+            if (instruction.mnemonic == ZYDIS_MNEMONIC_NOP || instruction.mnemonic == ZYDIS_MNEMONIC_JMP) {
+                offset += sizeof(uint32_t) * count_words_in_range(data + offset, size - offset, func.start, func.end - 1);
+            }
+        }
+    });
+
+    m_references.clear();
+    m_constants.clear();
+    m_instructions.clear();
+    m_operands.clear();
+
+    for (size_t i = 0; i < functions.size(); ++i) {
+        uint32_t operand_base = uint32_t(m_operands.size());
+
+        for (auto it = function_instructions[i].begin(); it != function_instructions[i].end(); ++it) {
+            m_instructions.push_back(*it);
+            m_instructions.back().first_operand += operand_base;
+        }
+
+        m_operands.insert(m_operands.end(), function_operands[i].begin(), function_operands[i].end());
+    }
+
+    build_bigrams();
+
+    for (auto it = function_refs.begin(); it != function_refs.end(); ++it) {
+        m_references.insert(m_references.end(), it->begin(), it->end());
+    }
+
+    for (auto it = function_consts.begin(); it != function_consts.end(); ++it) {
+        m_constants.insert(m_constants.end(), it->begin(), it->end());
+    }
+
+    std::sort(m_constants.begin(), m_constants.end(), [](const Constant &a, const Constant &b) {
+        return a.value < b.value || (a.value == b.value && a.address < b.address);
+    });
+
+    std::sort(m_references.begin(), m_references.end(), [](const Reference &a, const Reference &b) {
+        return a.target < b.target || (a.target == b.target && a.address < b.address);
+    });
+}
+
+void unassemblize::CodeIndex::load(const Executable &exe, const AnalysisDatabase &db)
+{
+    m_valueMask = exe.pointer_size() == sizeof(uint64_t) ? UINT64_MAX : UINT32_MAX;
+    m_references.clear();
+    m_constants.clear();
+
+    for (size_t i = 0; i < db.functions().size(); ++i) {
+        auto refs = db.references(i);
+
+        for (auto it = refs.first; it != refs.second; ++it) {
+            m_references.push_back({it->target, db.functions()[i].start, it->address});
+        }
+
+        auto consts = db.constants(i);
+
+        for (auto it = consts.first; it != consts.second; ++it) {
+            m_constants.push_back({it->value, db.functions()[i].start, it->address});
+        }
+    }
+
+    std::sort(m_constants.begin(), m_constants.end(), [](const Constant &a, const Constant &b) {
+        return a.value < b.value || (a.value == b.value && a.address < b.address);
+    });
+
+    std::sort(m_references.begin(), m_references.end(), [](const Reference &a, const Reference &b) {
+        return a.target < b.target || (a.target == b.target && a.address < b.address);
+    });
+
+    m_instructions = db.instructions();
+    m_operands = db.operands();
+
+    // The dense pair table is far bigger than the instructions it is counted from and cheap to redo.
+    build_bigrams();
+}
+
+std::pair<const unassemblize::CodeIndex::Reference *, const unassemblize::CodeIndex::Reference *>
+    unassemblize::CodeIndex::references_to(uint64_t target) const
+{
+    auto range = std::equal_range(m_references.begin(),
+        m_references.end(),
+        Reference{target, 0, 0},
+        [](const Reference &a, const Reference &b) { return a.target < b.target; });
+
+    return {m_references.data() + (range.first - m_references.begin()),
+        m_references.data() + (range.second - m_references.begin())};
+}
+
+std::pair<const unassemblize::CodeIndex::Constant *, const unassemblize::CodeIndex::Constant *>
+    unassemblize::CodeIndex::uses_of(uint64_t value) const
+{
+    auto range = std::equal_range(m_constants.begin(),
+        m_constants.end(),
+        Constant{value, 0, 0},
+        [](const Constant &a, const Constant &b) { return a.value < b.value; });
+
+    return {m_constants.data() + (range.first - m_constants.begin()),
+        m_constants.data() + (range.second - m_constants.begin())};
+}
+
+void unassemblize::CodeIndex::build_bigrams()
+{
+    // Counting sort of instruction positions by mnemonic pair, pairs crossing into the next function are skipped.
+    const size_t mnemonic_count = ZYDIS_MNEMONIC_MAX_VALUE + 1;
+    m_bigramStarts.assign(mnemonic_count * mnemonic_count + 1, 0);
+
+    for (size_t i = 0; i + 1 < m_instructions.size(); ++i) {
+        if (!m_instructions[i + 1].function_start) {
+            ++m_bigramStarts[m_instructions[i].mnemonic * mnemonic_count + m_instructions[i + 1].mnemonic + 1];
+        }
+    }
+
+    for (size_t i = 1; i < m_bigramStarts.size(); ++i) {
+        m_bigramStarts[i] += m_bigramStarts[i - 1];
+    }
+
+    std::vector<uint32_t> fill(m_bigramStarts.begin(), m_bigramStarts.end() - 1);
+    m_bigramPositions.resize(m_bigramStarts.back());
+
+    for (size_t i = 0; i + 1 < m_instructions.size(); ++i) {
+        if (!m_instructions[i + 1].function_start) {
+            m_bigramPositions[fill[m_instructions[i].mnemonic * mnemonic_count + m_instructions[i + 1].mnemonic]++] =
+                uint32_t(i);
+        }
+    }
+}
+
+std::pair<const uint32_t *, const uint32_t *> unassemblize::CodeIndex::bigram_positions(
+    uint16_t first, uint16_t second) const
+{
+    const size_t mnemonic_count = ZYDIS_MNEMONIC_MAX_VALUE + 1;
+
+    if (m_bigramStarts.empty() || first >= mnemonic_count || second >= mnemonic_count) {
+        return {nullptr, nullptr};
+    }
+
+    size_t key = first * mnemonic_count + second;
+
+    return {m_bigramPositions.data() + m_bigramStarts[key], m_bigramPositions.data() + m_bigramStarts[key + 1]};
+}
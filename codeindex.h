@@ -0,0 +1,108 @@
+/**
+ * @file
+ *
+ * @brief Index built from decoding every function in the function table.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#pragma once
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+namespace unassemblize
+{
+class AnalysisDatabase;
+class Executable;
+
+class CodeIndex
+{
+public:
+    struct Reference
+    {
+        uint64_t target; // Address within the image the operand refers to.
+        uint64_t function; // Start of the function containing the instruction.
+        uint64_t address; // Address of the referencing instruction.
+    };
+
+    struct Operand
+    {
+        int64_t value; // Immediate value, absolute target of relative immediates or memory displacement.
+        uint16_t reg; // Register, or base register of memory operands.
+        uint16_t index; // Index register of memory operands.
+        uint8_t type; // ZydisOperandType.
+        uint8_t scale;
+    };
+
+    struct Instruction
+    {
+        uint64_t address;
+        uint32_t first_operand; // Index of the first operand in the operand array.
+        uint16_t mnemonic; // ZydisMnemonic.
+        uint8_t operand_count;
+        uint8_t function_start; // Non zero for the first instruction of a function.
+    };
+
+    struct Constant
+    {
+        uint64_t value; // Immediate or displacement, truncated to the pointer size.
+        uint64_t function;
+        uint64_t address;
+    };
+
+public:
+    /**
+     * Decodes all functions from the executable's function table in parallel and collects their references.
+     */
+    void build(const Executable &exe);
+    /**
+     * Fills every lookup from a saved analysis, skipping the decode. Only the bigram table is built again.
+     */
+    void load(const Executable &exe, const AnalysisDatabase &db);
+    const std::vector<Reference> &references() const { return m_references; }
+    /**
+     * Returns the range of references to exactly target.
+     */
+    std::pair<const Reference *, const Reference *> references_to(uint64_t target) const;
+    const std::vector<Constant> &constants() const { return m_constants; }
+    /**
+     * Returns the range of instructions using value as an immediate or displacement.
+     */
+    std::pair<const Constant *, const Constant *> uses_of(uint64_t value) const;
+    /**
+     * Decoded instructions of all functions, in function table order.
+     */
+    const std::vector<Instruction> &instructions() const { return m_instructions; }
+    const Operand &operand(const Instruction &instruction, unsigned i) const
+    {
+        return m_operands[instruction.first_operand + i];
+    }
+    const std::vector<Operand> &operands() const { return m_operands; }
+    /**
+     * Returns the range of instruction indices where mnemonic first is directly followed by second within a function.
+     */
+    std::pair<const uint32_t *, const uint32_t *> bigram_positions(uint16_t first, uint16_t second) const;
+    /**
+     * Mask applied to immediates and constants, immediates are stored truncated to the pointer size.
+     */
+    uint64_t value_mask() const { return m_valueMask; }
+
+private:
+    void build_bigrams();
+
+private:
+    std::vector<Reference> m_references; // Sorted by target.
+    std::vector<Constant> m_constants; // Sorted by value.
+    std::vector<Instruction> m_instructions;
+    std::vector<Operand> m_operands;
+    std::vector<uint32_t> m_bigramStarts; // Start of each mnemonic pair's positions, indexed by first * count + second.
+    std::vector<uint32_t> m_bigramPositions;
+    uint64_t m_valueMask;
+};
+} // namespace unassemblize
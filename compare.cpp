@@ -0,0 +1,246 @@
+/**
+ * @file
+ *
+ * @brief Comparison of functions between an original and a recompiled executable.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#include "compare.h"
+#include "analysisdb.h"
+#include "executable.h"
+#include "hash.h"
+#include "normalize.h"
+#include "parallel.h"
+#include "scan.h"
+#include <Zydis/Zydis.h>
+#include <algorithm>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <unordered_map>
+
+namespace
+{
+const int64_t s_maxEdits = 4096;
+
+// Hashes each instruction of normalized function bytes, bytes that fail to decode count as one instruction each.
+void instruction_hashes(const std::vector<uint8_t> &bytes, bool is_64, std::vector<uint64_t> &hashes)
+{
+    ZydisDecoder decoder;
+    ZydisDecodedInstruction instruction;
+    ZydisDecoderInit(&decoder,
+        is_64 ? ZYDIS_MACHINE_MODE_LONG_64 : ZYDIS_MACHINE_MODE_LEGACY_32,
+        is_64 ? ZYDIS_STACK_WIDTH_64 : ZYDIS_STACK_WIDTH_32);
+    ZydisDecoderEnableMode(&decoder, ZYDIS_DECODER_MODE_MINIMAL, ZYAN_TRUE);
+
+    for (size_t offset = 0; offset < bytes.size();) {
+        size_t length = 1;
+
+        if (ZYAN_SUCCESS(ZydisDecoderDecodeInstruction(
+                &decoder, nullptr, bytes.data() + offset, bytes.size() - offset, &instruction))) {
+            length = instruction.length;
+        }
+
+        hashes.push_back(unassemblize::fnv1a_64(bytes.data() + offset, length));
+        offset += length;
+    }
+}
+
+// Length of a common subsequence found by Myers' difference algorithm in O((n + m) D) time, D being the number of
+// instructions only one side has. Past s_maxEdits the longest subsequence found so far is returned, a lower bound.
+size_t common_length(const std::vector<uint64_t> &a, const std::vector<uint64_t> &b)
+{
+    const int64_t n = int64_t(a.size());
+    const int64_t m = int64_t(b.size());
+    const int64_t max_d = std::min(n + m, s_maxEdits);
+    const int64_t middle = max_d + 1;
+    std::vector<int64_t> furthest(size_t(2 * max_d + 3), 0); // Furthest x reached on each diagonal k = x - y.
+    int64_t best = 0;
+
+    for (int64_t d = 0; d <= max_d; ++d) {
+        for (int64_t k = -d; k <= d; k += 2) {
+            int64_t x = k == -d || (k != d && furthest[middle + k - 1] < furthest[middle + k + 1])
+                ? furthest[middle + k + 1]
+                : furthest[middle + k - 1] + 1;
+            int64_t y = x - k;
+
+            while (x < n && y < m && a[x] == b[y]) {
+                ++x;
+                ++y;
+            }
+
+            furthest[middle + k] = x;
+
+            if (x >= n && y >= m) {
+                return size_t((n + m - d) / 2);
+            }
+
+            // A path with d insertions and deletions to (x, y) pairs up the rest of its steps.
+            if (x <= n && y >= 0 && y <= m) {
+                best = std::max(best, (x + y - d) / 2);
+            }
+        }
+    }
+
+    return size_t(best);
+}
+} // namespace
+
+void unassemblize::Comparison::run(const Executable &original, const Executable &recompiled)
+{
+    std::unordered_map<std::string, const Executable::FunctionEntry *> named;
+    m_results.clear();
+
+    for (auto it = recompiled.functions().begin(); it != recompiled.functions().end(); ++it) {
+        const std::string &name = recompiled.get_symbol(it->start).name;
+
+        if (!name.empty()) {
+            named.emplace(name, &*it);
+        }
+    }
+
+    std::vector<std::pair<const Executable::FunctionEntry *, const Executable::FunctionEntry *>> pairs;
+    std::vector<const std::string *> names;
+
+    for (auto it = original.functions().begin(); it != original.functions().end(); ++it) {
+        const std::string &name = original.get_symbol(it->start).name;
+
+        if (name.empty()) {
+            continue;
+        }
+
+        auto found = named.find(name);
+        const Executable::FunctionEntry *other = found != named.end() ? found->second : nullptr;
+        pairs.push_back({&*it, other});
+        names.push_back(&name);
+        m_results.push_back({it->start, other != nullptr ? other->start : 0, MATCH_MISSING, 0.0f});
+    }
+
+    std::vector<std::pair<uint64_t, uint64_t>> hashes(pairs.size(), {0, 0});
+    std::vector<uint8_t> cached(pairs.size(), 0);
+
+    parallel_for(pairs.size(), [&](size_t i) {
+        if (pairs[i].second == nullptr) {
+            return;
+        }
+
+        Result &result = m_results[i];
+        std::vector<uint8_t> bytes_a;
+        std::vector<uint8_t> mask_a;
+        std::vector<uint8_t> bytes_b;
+        std::vector<uint8_t> mask_b;
+        const AnalysisDatabase *analysis = original.analysis();
+        size_t index = analysis != nullptr ? analysis->function_index(pairs[i].first->start) : SIZE_MAX;
+        bool stored = index != SIZE_MAX && analysis->functions()[index].end == pairs[i].first->end;
+        normalize_function(recompiled, pairs[i].second->start, pairs[i].second->end, bytes_b, mask_b);
+
+        // The original side of a cache hit doesn't need normalizing when a saved analysis has its fingerprint.
+        if (stored) {
+            hashes[i] = {analysis->fingerprint(index).bytes, fnv1a_64(bytes_b.data(), bytes_b.size())};
+        } else {
+            normalize_function(original, pairs[i].first->start, pairs[i].first->end, bytes_a, mask_a);
+            hashes[i] = {fnv1a_64(bytes_a.data(), bytes_a.size()), fnv1a_64(bytes_b.data(), bytes_b.size())};
+        }
+
+        // The cache is only read here, new results are merged in after all pairs are done.
+        auto entry = m_cache.find(*names[i]);
+
+        if (entry != m_cache.end() && entry->second.original_hash == hashes[i].first
+            && entry->second.recompiled_hash == hashes[i].second) {
+            result.match = entry->second.match;
+            result.similarity = entry->second.similarity;
+            cached[i] = 1;
+            return;
+        }
+
+        if (stored) {
+            normalize_function(original, pairs[i].first->start, pairs[i].first->end, bytes_a, mask_a);
+        }
+
+        if (bytes_a.size() == bytes_b.size()
+            && masked_equal(bytes_a.data(), mask_a.data(), bytes_b.data(), mask_b.data(), bytes_a.size())) {
+            result.match = MATCH_IDENTICAL;
+            result.similarity = 1.0f;
+            return;
+        }
+
+        std::vector<uint64_t> hashes_a;
+        std::vector<uint64_t> hashes_b;
+        instruction_hashes(bytes_a, original.pointer_size() == sizeof(uint64_t), hashes_a);
+        instruction_hashes(bytes_b, recompiled.pointer_size() == sizeof(uint64_t), hashes_b);
+        result.match = MATCH_DIFFERENT;
+
+        if (!hashes_a.empty() || !hashes_b.empty()) {
+            result.similarity = float(2 * common_length(hashes_a, hashes_b)) / float(hashes_a.size() + hashes_b.size());
+        }
+    });
+
+    m_cacheHits = 0;
+
+    for (size_t i = 0; i < pairs.size(); ++i) {
+        if (cached[i]) {
+            ++m_cacheHits;
+        } else if (pairs[i].second != nullptr) {
+            m_cache[*names[i]] = {hashes[i].first, hashes[i].second, m_results[i].match, m_results[i].similarity};
+        }
+    }
+}
+
+void unassemblize::Comparison::load_cache(const char *file_name)
+{
+    std::ifstream fs(file_name);
+
+    if (!fs.good()) {
+        return;
+    }
+
+    // A damaged cache is ignored rather than fatal, it is rebuilt on save.
+    nlohmann::json j = nlohmann::json::parse(fs, nullptr, false);
+
+    if (j.is_discarded() || !j.is_object() || !j.contains("version") || j.at("version") != 1 || !j.contains("results")
+        || !j.at("results").is_object()) {
+        return;
+    }
+
+    for (auto &item : j.at("results").items()) {
+        const nlohmann::json &entry = item.value();
+
+        // Entries are checked before reading so a hand edited or foreign file can't throw, bad ones are dropped.
+        if (!entry.is_object() || !entry.contains("original") || !entry.at("original").is_number_unsigned()
+            || !entry.contains("recompiled") || !entry.at("recompiled").is_number_unsigned() || !entry.contains("match")
+            || !entry.at("match").is_number_unsigned() || entry.at("match").get<uint32_t>() > MATCH_MISSING
+            || !entry.contains("similarity") || !entry.at("similarity").is_number()) {
+            continue;
+        }
+
+        CachedResult result;
+        entry.at("original").get_to(result.original_hash);
+        entry.at("recompiled").get_to(result.recompiled_hash);
+        entry.at("match").get_to(result.match);
+        entry.at("similarity").get_to(result.similarity);
+        m_cache[item.key()] = result;
+    }
+}
+
+void unassemblize::Comparison::save_cache(const char *file_name) const
+{
+    nlohmann::json j;
+    nlohmann::json &results = j["results"] = nlohmann::json::object();
+    j["version"] = 1;
+
+    for (auto it = m_cache.begin(); it != m_cache.end(); ++it) {
+        nlohmann::json &entry = results[it->first];
+        entry["original"] = it->second.original_hash;
+        entry["recompiled"] = it->second.recompiled_hash;
+        entry["match"] = it->second.match;
+        entry["similarity"] = it->second.similarity;
+    }
+
+    std::ofstream fs(file_name);
+    fs << j << std::endl;
+}
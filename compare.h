@@ -0,0 +1,74 @@
+/**
+ * @file
+ *
+ * @brief Comparison of functions between an original and a recompiled executable.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace unassemblize
+{
+class Executable;
+
+class Comparison
+{
+public:
+    enum MatchTypes
+    {
+        MATCH_IDENTICAL, // Equal once layout dependent bytes are masked.
+        MATCH_DIFFERENT,
+        MATCH_MISSING, // No function of the same name in the recompiled executable.
+    };
+
+    struct Result
+    {
+        uint64_t original; // Start of the function in the original executable.
+        uint64_t recompiled; // Start of the function in the recompiled executable, 0 if missing.
+        uint32_t match;
+        float similarity; // Share of instructions the alignment could pair up, 1 for identical functions.
+    };
+
+public:
+    /**
+     * Pairs named functions of both executables by symbol name and compares them in parallel.
+     * Masked bytes are compared first, only pairs that differ there get an instruction level alignment. Fingerprints
+     * come from the original's saved analysis where it has one.
+     */
+    void run(const Executable &original, const Executable &recompiled);
+    const std::vector<Result> &results() const { return m_results; }
+    /**
+     * Number of pairs whose result came from the cache in the last run.
+     */
+    size_t cache_hits() const { return m_cacheHits; }
+    /**
+     * Loads results of earlier runs, pairs whose normalized bytes are unchanged on both sides reuse them.
+     */
+    void load_cache(const char *file_name);
+    void save_cache(const char *file_name) const;
+
+private:
+    struct CachedResult
+    {
+        uint64_t original_hash; // Fingerprints of the normalized bytes of both functions.
+        uint64_t recompiled_hash;
+        uint32_t match;
+        float similarity;
+    };
+
+private:
+    std::vector<Result> m_results;
+    std::unordered_map<std::string, CachedResult> m_cache; // Keyed by symbol name.
+    size_t m_cacheHits = 0;
+};
+} // namespace unassemblize
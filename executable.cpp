@@ -11,12 +11,366 @@
  *            LICENSE
  */
 #include "executable.h"
+#include "analysisdb.h"
 #include "function.h"
+#include "hash.h"
+#include "normalize.h"
+#include "parallel.h"
+#include "scan.h"
+#include "symbolspans.h"
 #include <LIEF/LIEF.hpp>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <nlohmann/json.hpp>
+#include <set>
+#include <sstream>
+#include <string.h>
 #include <strings.h>
+#include <unordered_map>
+
+namespace
+{
+uint16_t get_le16(const uint8_t *data)
+{
+    return (data[1] << 8) | data[0];
+}
+
+uint32_t get_le32(const uint8_t *data)
+{
+    return (data[3] << 24) | (data[2] << 16) | (data[1] << 8) | data[0];
+}
+
+uint64_t get_le64(const uint8_t *data)
+{
+    return (uint64_t(get_le32(data + 4)) << 32) | get_le32(data);
+}
+
+uint64_t read_uleb128(const uint8_t *data, uint64_t size, uint64_t &pos)
+{
+    uint64_t result = 0;
+    unsigned shift = 0;
+
+    while (pos < size) {
+        uint8_t byte = data[pos++];
+
+        if (shift < 64) {
+            result |= uint64_t(byte & 0x7F) << shift;
+        }
+
+        shift += 7;
+
+        if ((byte & 0x80) == 0) {
+            break;
+        }
+    }
+
+    return result;
+}
+
+int64_t read_sleb128(const uint8_t *data, uint64_t size, uint64_t &pos)
+{
+    int64_t result = 0;
+    unsigned shift = 0;
+    uint8_t byte = 0;
+
+    while (pos < size) {
+        byte = data[pos++];
+
+        if (shift < 64) {
+            result |= int64_t(byte & 0x7F) << shift;
+        }
+
+        shift += 7;
+
+        if ((byte & 0x80) == 0) {
+            break;
+        }
+    }
+
+    if (shift < 64 && (byte & 0x40) != 0) {
+        result |= -(int64_t(1) << shift);
+    }
+
+    return result;
+}
+
+// Reads a DW_EH_PE encoded pointer from .eh_frame, only absolute and pc relative applications are supported.
+uint64_t read_encoded_pointer(
+    const uint8_t *data, uint64_t size, uint64_t &pos, uint8_t encoding, uint64_t section_address, uint32_t ptr_size)
+{
+    const uint64_t field_address = section_address + pos;
+    uint64_t value = 0;
+
+    if (encoding == 0xFF) { // DW_EH_PE_omit
+        return 0;
+    }
+
+    switch (encoding & 0x0F) {
+        case 0x00: // DW_EH_PE_absptr
+            if (pos + ptr_size > size) {
+                pos = size;
+                return 0;
+            }
+
+            value = ptr_size == sizeof(uint64_t) ? get_le64(data + pos) : get_le32(data + pos);
+            pos += ptr_size;
+            break;
+        case 0x01: // DW_EH_PE_uleb128
+            value = read_uleb128(data, size, pos);
+            break;
+        case 0x09: // DW_EH_PE_sleb128
+            value = read_sleb128(data, size, pos);
+            break;
+        case 0x02: // DW_EH_PE_udata2
+        case 0x0A: // DW_EH_PE_sdata2
+            if (pos + 2 > size) {
+                pos = size;
+                return 0;
+            }
+
+            value = (encoding & 0x08) ? uint64_t(int16_t(get_le16(data + pos))) : get_le16(data + pos);
+            pos += 2;
+            break;
+        case 0x03: // DW_EH_PE_udata4
+        case 0x0B: // DW_EH_PE_sdata4
+            if (pos + 4 > size) {
+                pos = size;
+                return 0;
+            }
+
+            value = (encoding & 0x08) ? uint64_t(int32_t(get_le32(data + pos))) : get_le32(data + pos);
+            pos += 4;
+            break;
+        case 0x04: // DW_EH_PE_udata8
+        case 0x0C: // DW_EH_PE_sdata8
+            if (pos + 8 > size) {
+                pos = size;
+                return 0;
+            }
+
+            value = get_le64(data + pos);
+            pos += 8;
+            break;
+        default:
+            pos = size;
+            return 0;
+    }
+
+    if ((encoding & 0x70) == 0x10) { // DW_EH_PE_pcrel
+        value += field_address;
+    }
+
+    if (ptr_size == sizeof(uint32_t)) {
+        value &= UINT32_MAX;
+    }
+
+    return value;
+}
+
+// Replaces every character GNU as doesn't accept in an unquoted symbol name.
+std::string gas_identifier(std::string name)
+{
+    for (auto it = name.begin(); it != name.end(); ++it) {
+        if (!isalnum((unsigned char)*it) && *it != '_' && *it != '.' && *it != '$') {
+            *it = '_';
+        }
+    }
+
+    return name;
+}
+
+// Turns a type descriptor name such as .?AVBar@Foo@@ into Foo__Bar, scopes are joined with __ instead of :: so the
+// name can be emitted as a label. Templates are left decorated apart from the characters a label can't have.
+std::string rtti_class_name(const std::string &decorated)
+{
+    std::string name = decorated.substr(4);
+    size_t end = name.rfind("@@");
+
+    if (end != std::string::npos) {
+        name.resize(end);
+    }
+
+    if (name.compare(0, 2, "?$") == 0) {
+        return gas_identifier(name);
+    }
+
+    std::string result;
+    size_t pos = name.size();
+
+    while (pos != 0) {
+        size_t sep = name.rfind('@', pos - 1);
+        size_t begin = sep == std::string::npos ? 0 : sep + 1;
+
+        if (!result.empty()) {
+            result += "__";
+        }
+
+        result += name.substr(begin, pos - begin);
+        pos = sep == std::string::npos ? 0 : sep;
+    }
+
+    return gas_identifier(result);
+}
+
+// Quotes a name for a CSV field or a JSON string.
+void write_quoted(FILE *fp, const char *name, bool json)
+{
+    fputc('"', fp);
+
+    for (const char *c = name; *c != '\0'; ++c) {
+        if (*c == '"') {
+            fputs(json ? "\\\"" : "\"\"", fp);
+        } else if (json && *c == '\\') {
+            fputs("\\\\", fp);
+        } else if (json && uint8_t(*c) < 0x20) {
+            fprintf(fp, "\\u%04x", *c);
+        } else {
+            fputc(*c, fp);
+        }
+    }
+
+    fputc('"', fp);
+}
+
+// Returns 1 if the section is flagged executable, 0 if it isn't and -1 if the format has no such flag.
+int execute_flag(const LIEF::Section &section)
+{
+    if (auto pe = dynamic_cast<const LIEF::PE::Section *>(&section)) {
+        return (pe->characteristics() & (0x20000000 | 0x20)) != 0; // IMAGE_SCN_MEM_EXECUTE, IMAGE_SCN_CNT_CODE
+    }
+
+    if (auto elf = dynamic_cast<const LIEF::ELF::Section *>(&section)) {
+        return (elf->flags() & 0x4) != 0; // SHF_EXECINSTR
+    }
+
+    if (auto macho = dynamic_cast<const LIEF::MachO::Section *>(&section)) {
+        return (macho->flags() & (0x80000000 | 0x400)) != 0; // S_ATTR_PURE_INSTRUCTIONS, S_ATTR_SOME_INSTRUCTIONS
+    }
+
+    return -1;
+}
+
+bool is_unresolved(const std::string &dep)
+{
+    const char *name = dep.c_str();
+
+    if (strncmp(name, "offset ", 7) == 0) {
+        name += 7;
+    }
+
+    return strncmp(name, "sub_", 4) == 0 || strncmp(name, "off_", 4) == 0 || strncmp(name, "unk_", 4) == 0;
+}
+
+std::string lower_case(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return char(tolower(c)); });
+    return str;
+}
+
+// Keeps characters every file system accepts and caps the length, mangled names easily exceed 255 bytes.
+std::string file_name_for(const std::string &name)
+{
+    const size_t max_length = 200;
+    std::string result = name;
+
+    for (auto it = result.begin(); it != result.end(); ++it) {
+        if (!isalnum((unsigned char)*it) && *it != '_' && *it != '-' && *it != '.') {
+            *it = '_';
+        }
+    }
+
+    if (result.empty() || result[0] == '.') {
+        result.insert(result.begin(), '_');
+    }
+
+    if (result.size() > max_length) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "_%016" PRIx64, unassemblize::fnv1a_64(name.data(), name.size()));
+        result.resize(max_length);
+        result += buffer;
+    }
+
+    return result;
+}
+
+std::string escape_make(const std::string &path)
+{
+    std::string result;
+
+    for (auto it = path.begin(); it != path.end(); ++it) {
+        if (*it == '$') {
+            result += '$';
+        } else if (*it == ' ' || *it == '#') {
+            result += '\\';
+        }
+
+        result += *it;
+    }
+
+    return result;
+}
+
+bool write_depfile(
+    const std::string &path, const std::vector<std::string> &targets, const std::vector<std::string> &prerequisites)
+{
+    FILE *fp = fopen(path.c_str(), "w");
+
+    if (fp == nullptr) {
+        return false;
+    }
+
+    for (auto it = targets.begin(); it != targets.end(); ++it) {
+        fprintf(fp, it == targets.begin() ? "%s" : " \\\n  %s", escape_make(*it).c_str());
+    }
+
+    fprintf(fp, ":");
+
+    for (auto it = prerequisites.begin(); it != prerequisites.end(); ++it) {
+        fprintf(fp, " \\\n  %s", escape_make(*it).c_str());
+    }
+
+    fprintf(fp, "\n");
+
+    return fclose(fp) == 0;
+}
+
+bool write_if_changed(const std::string &path, const std::string &content)
+{
+    {
+        std::ifstream fs(path, std::ios::binary);
+
+        if (fs.good()
+            && std::string(std::istreambuf_iterator<char>(fs), std::istreambuf_iterator<char>()) == content) {
+            return true;
+        }
+    }
+
+    std::ofstream fs(path, std::ios::binary);
+    fs << content;
+
+    return fs.good();
+}
+
+bool same_body(const unassemblize::Executable &exe,
+    const unassemblize::Executable::FunctionEntry &a,
+    const unassemblize::Executable::FunctionEntry &b)
+{
+    std::vector<uint8_t> a_bytes;
+    std::vector<uint8_t> b_bytes;
+    std::vector<uint8_t> mask;
+    std::vector<uint64_t> a_targets;
+    std::vector<uint64_t> b_targets;
+    unassemblize::normalize_function(exe, a.start, a.end, a_bytes, mask, &a_targets);
+    unassemblize::normalize_function(exe, b.start, b.end, b_bytes, mask, &b_targets);
+
+    return !a_bytes.empty() && a_bytes == b_bytes && a_targets == b_targets;
+}
+} // namespace
 
 const char unassemblize::Executable::s_symbolSection[] = "symbols";
 const char unassemblize::Executable::s_sectionsSection[] = "sections";
@@ -27,8 +381,12 @@ unassemblize::Executable::Executable(const char *file_name, OutputFormats format
     m_binary(LIEF::Parser::parse(file_name)),
     m_endAddress(0),
     m_outputFormat(format),
+    m_iatStart(0),
+    m_iatSize(0),
     m_codeAlignment(sizeof(uint32_t)),
     m_dataAlignment(sizeof(uint32_t)),
+    m_pointerSize(sizeof(uint32_t)),
+    m_pointerShift(2),
     m_codePad(0x90), // NOP
     m_dataPad(0x00),
     m_verbose(verbose),
@@ -39,6 +397,12 @@ unassemblize::Executable::Executable(const char *file_name, OutputFormats format
     }
 
     bool checked_image_base = false;
+    std::vector<std::pair<SectionInfo *, const LIEF::Section *>> classify;
+
+    if (m_binary->header().is_64()) {
+        m_pointerSize = sizeof(uint64_t);
+        m_pointerShift = 3;
+    }
 
     for (auto it = m_binary->sections().begin(); it != m_binary->sections().end(); ++it) {
         if (!it->name().empty() && it->size() != 0) {
@@ -63,16 +427,40 @@ unassemblize::Executable::Executable(const char *file_name, OutputFormats format
                 m_endAddress = section.address + section.size;
             }
 
-            // Naive split on whether section contains data or code... have entrypoint? Code, else data.
-            // Needs to be refined by providing a config file with section types specified.
-            if (section.address <= m_binary->entrypoint() && section.address + section.size >= m_binary->entrypoint()) {
-                section.type = SECTION_CODE;
+            section.type = SECTION_DATA;
+            auto found = classify.begin();
+
+            while (found != classify.end() && found->first != &section) {
+                ++found;
+            }
+
+            if (found != classify.end()) {
+                found->second = &*it;
             } else {
-                section.type = SECTION_DATA;
+                classify.push_back({&section, &*it});
             }
         }
     }
 
+    if (m_verbose) {
+        printf("Classifying sections...\n");
+    }
+
+    // Sections not flagged executable are data. Flagged ones and those of formats without flags are sampled too as
+    // older linkers often mark data executable. The config file can still override the result.
+    const uint64_t entry_point = m_binary->entrypoint();
+
+    parallel_for(classify.size(), [&](size_t i) {
+        SectionInfo &section = *classify[i].first;
+        int flag = execute_flag(*classify[i].second);
+
+        if (section.address <= entry_point && section.address + section.size >= entry_point) {
+            section.type = SECTION_CODE;
+        } else if (flag != 0 && looks_like_code(section.data, section.size, m_pointerSize == sizeof(uint64_t))) {
+            section.type = SECTION_CODE;
+        }
+    });
+
     if (m_verbose) {
         printf("Indexing embedded symbols...\n");
     }
@@ -86,76 +474,731 @@ unassemblize::Executable::Executable(const char *file_name, OutputFormats format
         }
     }
 
-    auto exe_imports = m_binary->imported_functions();
+    if (m_verbose) {
+        printf("Indexing imports...\n");
+    }
+
+    index_imports();
+
+    if (m_verbose) {
+        printf("Loading unwind tables...\n");
+    }
+
+    load_unwind_info();
+
+    if (m_verbose) {
+        printf("Indexing relocations...\n");
+    }
+
+    load_relocations();
+}
+
+const uint8_t *unassemblize::Executable::section_data(const char *name) const
+{
+    auto it = m_sections.find(name);
+    return it != m_sections.end() ? it->second.data : nullptr;
+}
+
+uint64_t unassemblize::Executable::section_address(const char *name) const
+{
+    auto it = m_sections.find(name);
+    return it != m_sections.end() ? it->second.address : UINT64_MAX;
+}
+
+uint64_t unassemblize::Executable::section_size(const char *name) const
+{
+    auto it = m_sections.find(name);
+    return it != m_sections.end() ? it->second.size : 0;
+}
+
+uint64_t unassemblize::Executable::base_address() const
+{
+    return m_binary->imagebase();
+}
+
+const unassemblize::Executable::Symbol &unassemblize::Executable::get_symbol(uint64_t addr) const
+{
+    static std::string empty;
+    static Symbol def(empty, 0, 0);
+    auto it = m_symbolMap.find(addr);
+
+    if (it != m_symbolMap.end()) {
+        return it->second;
+    }
+
+    return def;
+}
+
+const unassemblize::Executable::Symbol &unassemblize::Executable::get_nearest_symbol(uint64_t addr) const
+{
+    static std::string empty;
+    static Symbol def(empty, 0, 0);
+    auto it = m_symbolMap.lower_bound(addr);
+
+    if (it != m_symbolMap.end()) {
+        if (it->second.value == addr) {
+            return it->second;
+        } else {
+            return std::prev(it)->second;
+        }
+    }
+
+    return def;
+}
+
+const unassemblize::Executable::FunctionEntry *unassemblize::Executable::find_function(uint64_t addr) const
+{
+    auto it = std::upper_bound(m_functions.begin(), m_functions.end(), addr, [](uint64_t value, const FunctionEntry &entry) {
+        return value < entry.start;
+    });
+
+    if (it == m_functions.begin()) {
+        return nullptr;
+    }
+
+    --it;
+
+    return addr < it->end ? &*it : nullptr;
+}
+
+const unassemblize::Executable::SectionInfo *unassemblize::Executable::find_section(uint64_t addr) const
+{
+    for (auto it = m_sections.begin(); it != m_sections.end(); ++it) {
+        if (addr >= it->second.address && addr < it->second.address + it->second.size) {
+            return &it->second;
+        }
+    }
+
+    return nullptr;
+}
+
+bool unassemblize::Executable::is_relocated(uint64_t addr) const
+{
+    return std::binary_search(m_relocations.begin(), m_relocations.end(), addr);
+}
+
+void unassemblize::Executable::set_functions(const std::vector<FunctionEntry> &functions)
+{
+    m_functions = functions;
+    std::sort(m_functions.begin(), m_functions.end(), [](const FunctionEntry &a, const FunctionEntry &b) {
+        return a.start < b.start;
+    });
+}
+
+void unassemblize::Executable::add_symbol(const char *sym, uint64_t addr)
+{
+    if (m_symbolMap.find(addr) == m_symbolMap.end()) {
+        m_loadedSymbols.push_back(sym);
+        m_symbolMap.insert({addr, Symbol(m_loadedSymbols.back(), addr, 0)});
+    }
+}
+
+void unassemblize::Executable::index_imports()
+{
+    LIEF::PE::Binary *pe = dynamic_cast<LIEF::PE::Binary *>(m_binary.get());
+
+    // Only PE has a proper import address table, other formats just get their import symbols.
+    if (pe == nullptr) {
+        auto exe_imports = m_binary->imported_functions();
+
+        for (auto it = exe_imports.begin(); it != exe_imports.end(); ++it) {
+            if (it->value() != 0 && !it->name().empty() && m_symbolMap.find(it->value()) == m_symbolMap.end()) {
+                uint64_t value = it->value() > m_binary->imagebase() ? it->value() : it->value() + m_binary->imagebase();
+                m_loadedSymbols.push_back(it->name());
+                m_symbolMap.insert({it->value(), Symbol(m_loadedSymbols.back(), value, it->size())});
+            }
+        }
+
+        return;
+    }
+
+    std::vector<uint64_t> slots;
+    uint64_t iat_start = UINT64_MAX;
+    uint64_t iat_end = 0;
+
+    for (auto imp = pe->imports().begin(); imp != pe->imports().end(); ++imp) {
+        for (auto entry = imp->entries().begin(); entry != imp->entries().end(); ++entry) {
+            if (entry->name().empty() || entry->iat_address() == 0) {
+                continue;
+            }
+
+            // IAT addresses are RVAs, key the symbols on the absolute slot address operands will use.
+            uint64_t addr = m_binary->imagebase() + entry->iat_address();
+
+            if (m_symbolMap.find(addr) == m_symbolMap.end()) {
+                m_loadedSymbols.push_back(entry->name());
+                m_symbolMap.insert({addr, Symbol(m_loadedSymbols.back(), addr, m_pointerSize)});
+            }
+
+            slots.push_back(addr);
+            iat_start = std::min(iat_start, addr);
+            iat_end = std::max(iat_end, addr + m_pointerSize);
+        }
+    }
+
+    // Don't build a dense index for a pathological IAT layout, lookups will fall back to the symbol map.
+    if (slots.empty() || iat_end - iat_start > (uint64_t(1) << 24)) {
+        return;
+    }
+
+    m_iatStart = iat_start;
+    m_iatSize = iat_end - iat_start;
+    m_iatIndex.assign(m_iatSize >> m_pointerShift, nullptr);
+
+    for (auto it = slots.begin(); it != slots.end(); ++it) {
+        m_iatIndex[(*it - m_iatStart) >> m_pointerShift] = &m_symbolMap.find(*it)->second;
+    }
+}
+
+void unassemblize::Executable::find_import_thunks()
+{
+    if (m_iatIndex.empty()) {
+        return;
+    }
+
+    for (auto it = m_sections.begin(); it != m_sections.end(); ++it) {
+        const SectionInfo &section = it->second;
+
+        if (section.type != SECTION_CODE || section.size < 6) {
+            continue;
+        }
+
+        const uint8_t *end = section.data + section.size - 5;
+
+        // Thunks are jmp dword ptr [slot], FF 25 followed by the slot address, RIP relative on x64.
+        for (const uint8_t *p = section.data; (p = static_cast<const uint8_t *>(memchr(p, 0xFF, end - p))) != nullptr;
+             ++p) {
+            if (p[1] != 0x25) {
+                continue;
+            }
+
+            uint64_t thunk = section.address + (p - section.data);
+            uint64_t slot = get_le32(p + 2);
+
+            if (m_pointerSize == sizeof(uint64_t)) {
+                slot = thunk + 6 + int32_t(slot);
+            }
+
+            const Symbol *import = get_import(slot);
+
+            if (import != nullptr && m_symbolMap.find(thunk) == m_symbolMap.end()) {
+                m_loadedSymbols.push_back("j_" + import->name);
+                m_symbolMap.insert({thunk, Symbol(m_loadedSymbols.back(), thunk, 6)});
+            }
+        }
+    }
+}
+
+void unassemblize::Executable::load_unwind_info()
+{
+    auto pdata = m_sections.find(".pdata");
+
+    if (pdata != m_sections.end() && dynamic_cast<LIEF::PE::Binary *>(m_binary.get()) != nullptr) {
+        load_pdata(pdata->second);
+    }
+
+    auto eh_frame = m_sections.find(".eh_frame");
+
+    if (eh_frame != m_sections.end()) {
+        load_eh_frame(eh_frame->second);
+    }
+
+    std::sort(m_functions.begin(), m_functions.end(), [](const FunctionEntry &a, const FunctionEntry &b) {
+        return a.start < b.start || (a.start == b.start && a.end > b.end);
+    });
+
+    // Keep the widest range where several entries share a start address.
+    m_functions.erase(std::unique(m_functions.begin(),
+                          m_functions.end(),
+                          [](const FunctionEntry &a, const FunctionEntry &b) { return a.start == b.start; }),
+        m_functions.end());
+
+    if (m_verbose) {
+        printf("Found %zu functions in unwind tables.\n", m_functions.size());
+    }
+}
+
+void unassemblize::Executable::load_pdata(const SectionInfo &section)
+{
+    // RUNTIME_FUNCTION entries are BeginAddress, EndAddress and UnwindInfoAddress as image relative addresses.
+    const uint64_t entry_size = 3 * sizeof(uint32_t);
+    const uint64_t base = m_binary->imagebase();
+
+    for (uint64_t pos = 0; pos + entry_size <= section.size; pos += entry_size) {
+        uint32_t begin = get_le32(section.data + pos);
+        uint32_t end = get_le32(section.data + pos + sizeof(uint32_t));
+
+        // Table is zero padded to the section alignment.
+        if (begin == 0) {
+            break;
+        }
+
+        if (end > begin) {
+            m_functions.push_back({base + begin, base + end});
+        }
+    }
+}
+
+void unassemblize::Executable::load_eh_frame(const SectionInfo &section)
+{
+    const uint8_t *data = section.data;
+    const uint64_t size = section.size;
+    std::map<uint64_t, uint8_t> cie_encodings; // FDE pointer encoding for each CIE offset.
+    uint64_t offset = 0;
+
+    while (offset + sizeof(uint32_t) <= size) {
+        uint64_t pos = offset + sizeof(uint32_t);
+        uint64_t length = get_le32(data + offset);
+
+        // Zero length entry terminates the table.
+        if (length == 0) {
+            break;
+        }
+
+        if (length == UINT32_MAX) {
+            if (pos + sizeof(uint64_t) > size) {
+                break;
+            }
+
+            length = get_le64(data + pos);
+            pos += sizeof(uint64_t);
+        }
+
+        const uint64_t entry_end = pos + length;
+
+        if (length > size || entry_end > size || pos + sizeof(uint32_t) > entry_end) {
+            break;
+        }
+
+        const uint64_t id_pos = pos;
+        const uint32_t id = get_le32(data + pos);
+        pos += sizeof(uint32_t);
+
+        if (id == 0 && pos < entry_end) {
+            // CIE, only the augmentation data is of interest for the FDE pointer encoding.
+            uint8_t version = data[pos++];
+            const char *augmentation_data = reinterpret_cast<const char *>(data + pos);
+            std::string augmentation(augmentation_data, strnlen(augmentation_data, entry_end - pos));
+            uint8_t fde_encoding = 0; // DW_EH_PE_absptr
+            pos += augmentation.size() + 1;
+
+            if (augmentation.find("eh") != std::string::npos) {
+                pos += m_pointerSize;
+            }
+
+            read_uleb128(data, entry_end, pos); // Code alignment.
+            read_sleb128(data, entry_end, pos); // Data alignment.
+
+            if (version == 1) {
+                ++pos;
+            } else {
+                read_uleb128(data, entry_end, pos);
+            }
+
+            if (!augmentation.empty() && augmentation[0] == 'z') {
+                uint64_t aug_data_length = read_uleb128(data, entry_end, pos);
+                uint64_t aug_data_end = std::min(pos + aug_data_length, entry_end);
+
+                for (size_t i = 1; i < augmentation.size() && pos < aug_data_end; ++i) {
+                    if (augmentation[i] == 'R') {
+                        fde_encoding = data[pos++];
+                    } else if (augmentation[i] == 'P') {
+                        uint8_t encoding = data[pos++];
+                        read_encoded_pointer(data, aug_data_end, pos, encoding, section.address, m_pointerSize);
+                    } else if (augmentation[i] == 'L') {
+                        ++pos;
+                    } else if (augmentation[i] != 'S' && augmentation[i] != 'B') {
+                        break;
+                    }
+                }
+            }
+
+            cie_encodings[offset] = fde_encoding;
+        } else if (id <= id_pos) {
+            // FDE, the id is the distance back to its CIE.
+            auto cie = cie_encodings.find(id_pos - id);
+
+            if (cie != cie_encodings.end()) {
+                uint8_t encoding = cie->second;
+                uint64_t begin = read_encoded_pointer(data, entry_end, pos, encoding, section.address, m_pointerSize);
+                uint64_t range = read_encoded_pointer(data, entry_end, pos, encoding & 0x0F, section.address, m_pointerSize);
+
+                if (begin != 0 && range != 0) {
+                    m_functions.push_back({begin, begin + range});
+                }
+            }
+        }
+
+        offset = entry_end;
+    }
+}
+
+void unassemblize::Executable::discover_functions()
+{
+    if (m_verbose) {
+        printf("Discovering functions...\n");
+    }
+
+    recover_symbols();
+
+    // Named symbols in code sections are function starts we already trust.
+    for (auto it = m_symbolMap.begin(); it != m_symbolMap.end(); ++it) {
+        const SectionInfo *section = find_section(it->second.value);
+
+        if (section != nullptr && section->type == SECTION_CODE && it->second.name.compare(0, 4, "loc_") != 0) {
+            queue_function(it->second.value);
+        }
+    }
+
+    scan_code_prologues();
+    scan_code_pointers();
+    build_function_table();
+
+    if (m_verbose) {
+        printf("Function table has %zu entries.\n", m_functions.size());
+    }
+}
+
+void unassemblize::Executable::recover_symbols()
+{
+    if (m_symbolsRecovered) {
+        return;
+    }
+
+    m_symbolsRecovered = true;
+    find_import_thunks();
+
+    if (dynamic_cast<LIEF::PE::Binary *>(m_binary.get()) != nullptr) {
+        recover_vtables();
+    }
+}
+
+std::vector<unassemblize::Executable::DataChunk> unassemblize::Executable::data_chunks() const
+{
+    // Sized so a single big .data section still spreads over all threads.
+    const uint64_t chunk_size = 1024 * 1024;
+    std::vector<DataChunk> chunks;
+
+    for (auto it = m_sections.begin(); it != m_sections.end(); ++it) {
+        if (it->second.type != SECTION_DATA) {
+            continue;
+        }
+
+        for (uint64_t offset = 0; offset < it->second.size; offset += chunk_size) {
+            chunks.push_back({&it->second, offset, std::min(chunk_size, it->second.size - offset)});
+        }
+    }
+
+    return chunks;
+}
+
+void unassemblize::Executable::index_strings(bool searchable)
+{
+    if (m_verbose) {
+        printf("Indexing strings...\n");
+    }
+
+    m_strings.build(*this);
+
+    if (searchable) {
+        m_strings.build_search_index();
+    }
+
+    if (m_verbose) {
+        printf("Found %zu strings.\n", m_strings.entries().size());
+    }
+}
+
+void unassemblize::Executable::scan_code_prologues()
+{
+    std::vector<uint64_t> offsets;
+
+    for (auto it = m_sections.begin(); it != m_sections.end(); ++it) {
+        if (it->second.type != SECTION_CODE) {
+            continue;
+        }
+
+        offsets.clear();
+        scan_prologues(it->second.data, it->second.size, offsets);
+
+        for (auto offset = offsets.begin(); offset != offsets.end(); ++offset) {
+            queue_function(it->second.address + *offset);
+        }
+    }
+}
+
+void unassemblize::Executable::scan_code_pointers()
+{
+    std::vector<DataChunk> chunks = data_chunks();
+    std::vector<std::vector<uint64_t>> chunk_targets(chunks.size());
+    uint64_t code_low = UINT64_MAX;
+    uint64_t code_high = 0;
+
+    for (auto it = m_sections.begin(); it != m_sections.end(); ++it) {
+        if (it->second.type == SECTION_CODE) {
+            code_low = std::min(code_low, it->second.address);
+            code_high = std::max(code_high, it->second.address + it->second.size);
+        }
+    }
+
+    if (code_low >= code_high) {
+        return;
+    }
+
+    parallel_for(chunks.size(), [&](size_t i) {
+        const DataChunk &chunk = chunks[i];
+        const uint8_t *data = chunk.section->data + chunk.offset;
+        uint64_t address = chunk.section->address + chunk.offset;
+        std::vector<uint64_t> offsets;
+        scan_pointers(data, chunk.size, address, m_pointerSize, code_low, code_high, offsets);
+
+        for (auto it = offsets.begin(); it != offsets.end(); ++it) {
+            // Relocations tell real pointers apart from integers that happen to look like one.
+            if (has_relocations() && !is_relocated(address + *it)) {
+                continue;
+            }
+
+            uint64_t target = m_pointerSize == sizeof(uint64_t) ? get_le64(data + *it) : get_le32(data + *it);
+            const SectionInfo *section = find_section(target);
+
+            // Only take targets that look like a function start, data pointing at jump table cases or SEH
+            // handlers inside a function would otherwise split it.
+            if (section != nullptr && section->type == SECTION_CODE
+                && is_function_start(section->data, section->size, target - section->address)) {
+                chunk_targets[i].push_back(target);
+            }
+        }
+    });
+
+    for (auto it = chunk_targets.begin(); it != chunk_targets.end(); ++it) {
+        m_functionQueue.insert(m_functionQueue.end(), it->begin(), it->end());
+    }
+}
+
+void unassemblize::Executable::recover_vtables()
+{
+    struct Locator
+    {
+        const std::string *name;
+        uint32_t offset; // Offset of the vtable's subobject in the complete class.
+    };
+
+    std::vector<DataChunk> chunks = data_chunks();
+    std::vector<std::vector<std::pair<uint64_t, std::string>>> chunk_types(chunks.size());
+    std::vector<std::vector<std::pair<uint64_t, Locator>>> chunk_locators(chunks.size());
+    std::vector<std::vector<std::pair<uint64_t, const Locator *>>> chunk_vtables(chunks.size());
+    std::unordered_map<uint64_t, std::string> types;
+    std::unordered_map<uint64_t, Locator> locators;
+    const uint64_t image_base = m_binary->imagebase();
+    const uint64_t name_offset = 2 * m_pointerSize;
+    const bool is_64 = m_pointerSize == sizeof(uint64_t);
+
+    // Each pass is a single linear scan over the data sections with hash lookups into the previous pass.
+    // TypeDescriptor: vftable pointer, spare pointer then the decorated name.
+    parallel_for(chunks.size(), [&](size_t i) {
+        const DataChunk &chunk = chunks[i];
+        const SectionInfo &section = *chunk.section;
+        std::vector<uint64_t> offsets;
+        scan_pattern(section.data + chunk.offset, std::min(chunk.size + 3, section.size - chunk.offset), ".?A", 3, offsets);
+
+        for (auto it = offsets.begin(); it != offsets.end(); ++it) {
+            uint64_t pos = chunk.offset + *it;
+
+            if (*it >= chunk.size || pos < name_offset || pos + 4 >= section.size) {
+                continue;
+            }
+
+            char kind = section.data[pos + 3];
+            const char *name = reinterpret_cast<const char *>(section.data + pos);
+            size_t length = strnlen(name, section.size - pos);
+
+            if ((kind != 'V' && kind != 'U') || pos + length == section.size) {
+                continue;
+            }
+
+            chunk_types[i].push_back({section.address + pos - name_offset, rtti_class_name(std::string(name, length))});
+        }
+    });
+
+    for (auto it = chunk_types.begin(); it != chunk_types.end(); ++it) {
+        types.insert(it->begin(), it->end());
+    }
+
+    if (types.empty()) {
+        return;
+    }
+
+    // CompleteObjectLocator: signature, offset, cd offset, type descriptor, hierarchy descriptor and on x64 an
+    // image relative pointer to itself. x86 uses absolute pointers with signature 0, x64 uses RVAs and signature 1.
+    parallel_for(chunks.size(), [&](size_t i) {
+        const DataChunk &chunk = chunks[i];
+        const SectionInfo &section = *chunk.section;
+        const uint64_t locator_size = is_64 ? 6 * sizeof(uint32_t) : 5 * sizeof(uint32_t);
+
+        for (uint64_t pos = chunk.offset + ((4 - (section.address + chunk.offset)) & 3);
+             pos < chunk.offset + chunk.size && pos + locator_size <= section.size;
+             pos += sizeof(uint32_t)) {
+            const uint8_t *p = section.data + pos;
+            uint64_t address = section.address + pos;
+
+            if (get_le32(p) != (is_64 ? 1u : 0u)) {
+                continue;
+            }
+
+            uint64_t type = get_le32(p + 12);
+
+            if (is_64) {
+                if (image_base + get_le32(p + 20) != address) {
+                    continue;
+                }
+
+                type += image_base;
+            }
+
+            auto found = types.find(type);
+
+            if (found != types.end()) {
+                chunk_locators[i].push_back({address, {&found->second, get_le32(p + 4)}});
+            }
+        }
+    });
+
+    uint64_t locator_low = UINT64_MAX;
+    uint64_t locator_high = 0;
+
+    for (auto it = chunk_locators.begin(); it != chunk_locators.end(); ++it) {
+        for (auto loc = it->begin(); loc != it->end(); ++loc) {
+            locators.insert(*loc);
+            locator_low = std::min(locator_low, loc->first);
+            locator_high = std::max(locator_high, loc->first + 1);
+        }
+    }
+
+    if (locators.empty()) {
+        return;
+    }
+
+    // The pointer right before a vtable's first slot points at its locator.
+    parallel_for(chunks.size(), [&](size_t i) {
+        const DataChunk &chunk = chunks[i];
+        const uint8_t *data = chunk.section->data + chunk.offset;
+        uint64_t address = chunk.section->address + chunk.offset;
+        std::vector<uint64_t> offsets;
+        scan_pointers(data, chunk.size, address, m_pointerSize, locator_low, locator_high, offsets);
+
+        for (auto it = offsets.begin(); it != offsets.end(); ++it) {
+            uint64_t target = is_64 ? get_le64(data + *it) : get_le32(data + *it);
+            auto found = locators.find(target);
+
+            if (found != locators.end()) {
+                chunk_vtables[i].push_back({address + *it + m_pointerSize, &found->second});
+            }
+        }
+    });
+
+    std::vector<std::pair<uint64_t, const Locator *>> vtables;
+
+    for (auto it = chunk_vtables.begin(); it != chunk_vtables.end(); ++it) {
+        vtables.insert(vtables.end(), it->begin(), it->end());
+    }
+
+    std::sort(vtables.begin(), vtables.end());
 
-    for (auto it = exe_imports.begin(); it != exe_imports.end(); ++it) {
-        if (it->value() != 0 && !it->name().empty() && m_symbolMap.find(it->value()) == m_symbolMap.end()) {
-            uint64_t value = it->value() > m_binary->imagebase() ? it->value() : it->value() + m_binary->imagebase();
-            m_loadedSymbols.push_back(it->name());
-            m_symbolMap.insert({it->value(), Symbol(m_loadedSymbols.back(), value, it->size())});
+    for (auto it = vtables.begin(); it != vtables.end(); ++it) {
+        const SectionInfo *section = find_section(it->first);
+
+        if (section == nullptr) {
+            continue;
         }
-    }
-}
 
-const uint8_t *unassemblize::Executable::section_data(const char *name) const
-{
-    auto it = m_sections.find(name);
-    return it != m_sections.end() ? it->second.data : nullptr;
-}
+        // Vtables for base class subobjects get the subobject offset appended to stay unique.
+        std::stringstream suffix;
 
-uint64_t unassemblize::Executable::section_address(const char *name) const
-{
-    auto it = m_sections.find(name);
-    return it != m_sections.end() ? it->second.address : UINT64_MAX;
-}
+        if (it->second->offset != 0) {
+            suffix << '_' << std::hex << it->second->offset;
+        }
 
-uint64_t unassemblize::Executable::section_size(const char *name) const
-{
-    auto it = m_sections.find(name);
-    return it != m_sections.end() ? it->second.size : 0;
-}
+        add_symbol((*it->second->name + "__vftable" + suffix.str()).c_str(), it->first);
+        uint32_t index = 0;
 
-uint64_t unassemblize::Executable::base_address() const
-{
-    return m_binary->imagebase();
-}
+        // Slots run until the first value that isn't a pointer into code, usually the next vtable's locator.
+        for (uint64_t slot = it->first - section->address; slot + m_pointerSize <= section->size; slot += m_pointerSize) {
+            uint64_t target = is_64 ? get_le64(section->data + slot) : get_le32(section->data + slot);
+            const SectionInfo *target_section = find_section(target);
 
-const unassemblize::Executable::Symbol &unassemblize::Executable::get_symbol(uint64_t addr) const
-{
-    static std::string empty;
-    static Symbol def(empty, 0, 0);
-    auto it = m_symbolMap.find(addr);
+            if (target_section == nullptr || target_section->type != SECTION_CODE) {
+                break;
+            }
 
-    if (it != m_symbolMap.end()) {
-        return it->second;
+            std::stringstream name;
+            name << *it->second->name << "__vf" << index++ << suffix.str();
+            add_symbol(name.str().c_str(), target);
+            queue_function(target);
+        }
     }
 
-    return def;
+    if (m_verbose) {
+        printf("Recovered %zu vtables from RTTI.\n", vtables.size());
+    }
 }
 
-const unassemblize::Executable::Symbol &unassemblize::Executable::get_nearest_symbol(uint64_t addr) const
+void unassemblize::Executable::build_function_table()
 {
-    static std::string empty;
-    static Symbol def(empty, 0, 0);
-    auto it = m_symbolMap.lower_bound(addr);
-
-    if (it != m_symbolMap.end()) {
-        if (it->second.value == addr) {
-            return it->second;
-        } else {
-            return std::prev(it)->second;
+    std::sort(m_functionQueue.begin(), m_functionQueue.end());
+    m_functionQueue.erase(std::unique(m_functionQueue.begin(), m_functionQueue.end()), m_functionQueue.end());
+    std::vector<FunctionEntry> candidates;
+
+    // Candidates inside a function with a known range are just code within it.
+    for (auto it = m_functionQueue.begin(); it != m_functionQueue.end(); ++it) {
+        if (find_function(*it) == nullptr) {
+            candidates.push_back({*it, 0});
         }
     }
 
-    return def;
+    m_functionQueue.clear();
+    m_functions.insert(m_functions.end(), candidates.begin(), candidates.end());
+    std::sort(m_functions.begin(), m_functions.end(), [](const FunctionEntry &a, const FunctionEntry &b) {
+        return a.start < b.start || (a.start == b.start && a.end > b.end);
+    });
+    m_functions.erase(std::unique(m_functions.begin(),
+                          m_functions.end(),
+                          [](const FunctionEntry &a, const FunctionEntry &b) { return a.start == b.start; }),
+        m_functions.end());
+
+    // Without exact bounds a function runs until the next one or the end of its section.
+    for (size_t i = 0; i < m_functions.size(); ++i) {
+        FunctionEntry &entry = m_functions[i];
+
+        if (entry.end != 0) {
+            continue;
+        }
+
+        const SectionInfo *section = find_section(entry.start);
+        entry.end = section != nullptr ? section->address + section->size : entry.start + 1;
+
+        if (i + 1 < m_functions.size() && m_functions[i + 1].start < entry.end) {
+            entry.end = m_functions[i + 1].start;
+        }
+    }
 }
 
-void unassemblize::Executable::add_symbol(const char *sym, uint64_t addr)
+void unassemblize::Executable::load_relocations()
 {
-    if (m_symbolMap.find(addr) == m_symbolMap.end()) {
-        m_loadedSymbols.push_back(sym);
-        m_symbolMap.insert({addr, Symbol(m_loadedSymbols.back(), addr, 0)});
+    auto relocs = m_binary->relocations();
+
+    for (auto it = relocs.begin(); it != relocs.end(); ++it) {
+        uint64_t address = it->address();
+
+        // PE relocations are image relative like the section addresses.
+        if (m_addBase && address < m_binary->imagebase()) {
+            address += m_binary->imagebase();
+        }
+
+        m_relocations.push_back(address);
     }
+
+    std::sort(m_relocations.begin(), m_relocations.end());
+    m_relocations.erase(std::unique(m_relocations.begin(), m_relocations.end()), m_relocations.end());
 }
 
 void unassemblize::Executable::load_config(const char *file_name)
@@ -399,31 +1442,530 @@ void unassemblize::Executable::dissassemble_function(
     }
 }
 
+std::string unassemblize::Executable::function_text(const char *section_name, uint64_t start, uint64_t end)
+{
+    return m_outputFormat != OUTPUT_MASM ? gas_function_text(section_name, start, end) : std::string();
+}
+
+void unassemblize::Executable::dissassemble_functions(
+    FILE *output, const char *section_name, bool fold, FILE *index, SymbolSpans *spans)
+{
+    if (output == nullptr) {
+        return;
+    }
+
+    std::vector<const FunctionEntry *> functions = section_functions(section_name);
+    std::vector<size_t> canonical = fold ? find_duplicates(functions) : std::vector<size_t>();
+    size_t folded = 0;
+    long position = ftell(output);
+    uint64_t offset = position > 0 ? uint64_t(position) : 0;
+
+    if (index != nullptr) {
+        fprintf(index, "name\taddress\toffset\tlength\n");
+    }
+
+    for (size_t i = 0; i < functions.size(); ++i) {
+        const uint64_t start = functions[i]->start;
+        std::string text;
+
+        if (fold && canonical[i] != i) {
+            text = alias_text(section_name, start, functions[canonical[i]]->start, spans, offset);
+            ++folded;
+        } else if (m_outputFormat != OUTPUT_MASM) {
+            // Function end addresses are inclusive, the table stores exclusive ones.
+            text = gas_function_text(section_name, start, functions[i]->end - 1, spans, offset);
+        }
+
+        // Offsets are counted rather than asked for so they stay exact past 2 GiB where ftell can't report them.
+        if (index != nullptr) {
+            fprintf(index,
+                "%s\t0x%" PRIx64 "\t%" PRIu64 "\t%zu\n",
+                function_label(start).c_str(),
+                start,
+                offset,
+                text.size());
+        }
+
+        text += '\n';
+        fwrite(text.data(), 1, text.size(), output);
+        offset += text.size();
+    }
+
+    if (m_verbose && fold) {
+        printf("Folded %zu functions into identical bodies emitted earlier.\n", folded);
+    }
+}
+
+bool unassemblize::Executable::dissassemble_to_directory(
+    const char *directory, const char *section_name, SymbolSpans *spans, bool incremental)
+{
+    if (m_outputFormat == OUTPUT_MASM) {
+        return false;
+    }
+
+    std::vector<const FunctionEntry *> functions = section_functions(section_name);
+    std::vector<std::string> paths(functions.size());
+    std::set<std::string> taken;
+    std::set<std::string> object_dirs;
+    std::map<std::string, std::vector<size_t>> objects;
+    std::error_code error;
+
+    if (m_verbose) {
+        printf("Writing %zu functions to '%s'...\n", functions.size(), directory);
+    }
+
+    // Names only depend on the symbol table, so every path and directory is known before anything is formatted.
+    for (size_t i = 0; i < functions.size(); ++i) {
+        const uint64_t address = functions[i]->start;
+        std::string object = file_name_for(object_name(section_name, address));
+        std::string name = file_name_for(function_label(address));
+        std::string path = object + '/' + name + ".S";
+
+        // Sanitizing and case insensitive file systems can map different symbols to one file.
+        if (!taken.insert(lower_case(path)).second) {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "_%" PRIx64, address);
+            path = object + '/' + name + buffer + ".S";
+            taken.insert(lower_case(path));
+        }
+
+        object_dirs.insert(object);
+        objects[object].push_back(i);
+        paths[i] = path;
+    }
+
+    for (auto it = object_dirs.begin(); it != object_dirs.end(); ++it) {
+        std::filesystem::create_directories(std::filesystem::path(directory) / *it, error);
+    }
+
+    nlohmann::json manifest = nlohmann::json::array();
+
+    for (size_t i = 0; i < functions.size(); ++i) {
+        manifest.push_back({{"name", function_label(functions[i]->start)},
+            {"address", functions[i]->start},
+            {"size", functions[i]->end - functions[i]->start},
+            {"file", paths[i]}});
+    }
+
+    write_if_changed((std::filesystem::path(directory) / "manifest.json").string(), manifest.dump(4) + '\n');
+
+    // Stamps are worked out before formatting adds any symbols, an object whose stamp and files are unchanged is left
+    // alone. Spans need every file formatted so they turn skipping off.
+    std::vector<std::string> entries(incremental ? functions.size() : 0);
+    std::vector<uint8_t> skip(functions.size(), 0);
+    std::map<std::string, std::string> stamps;
+
+    parallel_for(entries.size(), [&](size_t i) { entries[i] = function_stamp(*functions[i], paths[i]); });
+
+    for (auto it = objects.begin(); it != objects.end() && incremental; ++it) {
+        std::string stamp = (std::filesystem::path(directory) / (it->first + ".syms")).string();
+        std::string content = m_outputFormat == OUTPUT_IGAS ? "igas\n" : "agas\n";
+        bool unchanged = spans == nullptr;
+
+        for (auto i = it->second.begin(); i != it->second.end(); ++i) {
+            content += entries[*i];
+            unchanged = unchanged && std::filesystem::exists(std::filesystem::path(directory) / paths[*i], error);
+        }
+
+        std::ifstream fs(stamp, std::ios::binary);
+        unchanged = unchanged && fs.good()
+            && std::string(std::istreambuf_iterator<char>(fs), std::istreambuf_iterator<char>()) == content;
+
+        for (auto i = it->second.begin(); i != it->second.end() && unchanged; ++i) {
+            skip[*i] = 1;
+        }
+
+        stamps[stamp] = content;
+    }
+
+    // Formatting adds symbols so it happens in order, a batch at a time to bound the memory held for the writers.
+    const size_t batch_size = 1024;
+    static const char header[] = ".intel_syntax noprefix\n\n";
+    const size_t header_size = sizeof(header) - 1;
+    std::vector<std::string> texts;
+    std::atomic<size_t> failed(0);
+    size_t skipped = 0;
+
+    for (size_t first = 0; first < functions.size(); first += batch_size) {
+        const size_t last = std::min(functions.size(), first + batch_size);
+        texts.assign(last - first, std::string());
+
+        for (size_t i = first; i < last; ++i) {
+            if (skip[i]) {
+                ++skipped;
+                continue;
+            }
+
+            if (spans != nullptr) {
+                spans->add_file(paths[i]);
+            }
+
+            texts[i - first] = header
+                + gas_function_text(section_name, functions[i]->start, functions[i]->end - 1, spans, header_size);
+        }
+
+        // Unchanged files keep their time, so only objects whose text changed are assembled again.
+        parallel_for(texts.size(), [&](size_t i) {
+            if (!skip[first + i]
+                && !write_if_changed((std::filesystem::path(directory) / paths[first + i]).string(), texts[i])) {
+                ++failed;
+            }
+        });
+    }
+
+    // Stamps are rewritten even when unchanged, they are what a build system compares with the inputs. Without every
+    // file written the old stamp has to stay, so the next run retries.
+    for (auto it = stamps.begin(); it != stamps.end() && failed == 0; ++it) {
+        std::ofstream fs(it->first, std::ios::binary);
+        fs << it->second;
+
+        if (!fs.good()) {
+            ++failed;
+        }
+
+        m_objectStamps.push_back(it->first);
+    }
+
+    if (m_verbose && skipped != 0) {
+        printf("Skipped %zu functions of objects that didn't change.\n", skipped);
+    }
+
+    if (m_verbose && failed != 0) {
+        printf("Failed to write %zu files.\n", size_t(failed));
+    }
+
+    return failed == 0;
+}
+
+std::vector<const unassemblize::Executable::FunctionEntry *> unassemblize::Executable::section_functions(
+    const char *section_name) const
+{
+    uint64_t section_start = section_address(section_name);
+    uint64_t section_end = section_start + section_size(section_name);
+    std::vector<const FunctionEntry *> functions;
+
+    for (auto it = m_functions.begin(); it != m_functions.end(); ++it) {
+        if (it->start >= section_start && it->end <= section_end) {
+            functions.push_back(&*it);
+        }
+    }
+
+    return functions;
+}
+
+std::vector<size_t> unassemblize::Executable::find_duplicates(const std::vector<const FunctionEntry *> &functions) const
+{
+    std::vector<size_t> canonical(functions.size());
+    std::vector<uint64_t> hashes(functions.size());
+
+    // MASM output isn't supported yet, so there is nothing to alias there.
+    if (m_outputFormat == OUTPUT_MASM) {
+        for (size_t i = 0; i < functions.size(); ++i) {
+            canonical[i] = i;
+        }
+
+        return canonical;
+    }
+
+    // Hashing decodes every function, which is independent work, only the emitting has to stay in order. A saved
+    // analysis already has the hash of every function it covers.
+    parallel_for(hashes.size(), [&](size_t i) {
+        size_t index = m_analysis != nullptr ? m_analysis->function_index(functions[i]->start) : SIZE_MAX;
+
+        if (index != SIZE_MAX && m_analysis->functions()[index].end == functions[i]->end) {
+            hashes[i] = m_analysis->fingerprint(index).body;
+        } else {
+            hashes[i] = function_fingerprint(*this, functions[i]->start, functions[i]->end).body;
+        }
+    });
+
+    // A hash match is only a candidate, functions are aliased after their normalized bodies compare equal. Every
+    // distinct body with a hash is kept so a collision doesn't hide a later real duplicate.
+    std::unordered_map<uint64_t, std::vector<size_t>> bodies;
+
+    for (size_t i = 0; i < functions.size(); ++i) {
+        canonical[i] = i;
+
+        if (hashes[i] == 0) {
+            continue;
+        }
+
+        std::vector<size_t> &candidates = bodies[hashes[i]];
+
+        for (auto it = candidates.begin(); it != candidates.end(); ++it) {
+            if (same_body(*this, *functions[*it], *functions[i])) {
+                canonical[i] = *it;
+                break;
+            }
+        }
+
+        if (canonical[i] == i) {
+            candidates.push_back(i);
+        }
+    }
+
+    return canonical;
+}
+
+std::string unassemblize::Executable::function_label(uint64_t address) const
+{
+    const std::string &sym = get_symbol(address).name;
+
+    if (!sym.empty()) {
+        return sym;
+    }
+
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "sub_%" PRIx64, address);
+
+    return buffer;
+}
+
+std::string unassemblize::Executable::object_name(const char *section_name, uint64_t address) const
+{
+    const uint64_t offset = address - section_address(section_name);
+
+    // Object section starts are offsets into the section of the binary.
+    for (auto it = m_targetObjects.begin(); it != m_targetObjects.end(); ++it) {
+        for (auto sec = it->sections.begin(); sec != it->sections.end(); ++sec) {
+            if (sec->name == section_name && offset >= sec->start && offset < sec->start + sec->size) {
+                return it->name;
+            }
+        }
+    }
+
+    return m_binary->name().substr(m_binary->name().find_last_of("/\\") + 1);
+}
+
+std::string unassemblize::Executable::alias_text(
+    const char *section_name, uint64_t address, uint64_t canonical, SymbolSpans *spans, uint64_t base)
+{
+    std::string alias = function_label(address);
+    std::string target = function_label(canonical);
+
+    if (spans != nullptr) {
+        spans->add(base + 7, alias.c_str(), alias.size());
+        spans->add(base + alias.size() + 13, alias.c_str(), alias.size());
+        spans->add(base + alias.size() * 2 + 15, target.c_str(), target.size());
+    }
+
+    return ".globl " + alias + "\n.set " + alias + ", " + target + "\n";
+}
+
+std::string unassemblize::Executable::gas_function_text(
+    const char *section_name, uint64_t start, uint64_t end, SymbolSpans *spans, uint64_t base)
+{
+    unassemblize::Function func(*this, section_name, start, end);
+    size_t index = m_analysis != nullptr ? m_analysis->function_index(start) : SIZE_MAX;
+
+    // A stored analysis of the same range replaces the label pass, disassemble falls back to it otherwise.
+    if (index != SIZE_MAX && m_analysis->functions()[index].end == end + 1) {
+        auto flow = m_analysis->flow(index);
+        auto tables = m_analysis->jump_tables(index);
+        auto labels = m_analysis->labels(index);
+        func.seed({flow.first, flow.second}, {tables.first, tables.second}, {labels.first, labels.second});
+    }
+
+    if (m_outputFormat == OUTPUT_IGAS) {
+        func.disassemble(Function::FORMAT_IGAS);
+    } else {
+        func.disassemble(Function::FORMAT_AGAS);
+    }
+
+    record_metrics(func);
+
+    if (m_verbose && func.unreachable_bytes() != 0) {
+        printf("Function at 0x%" PRIx64 " has %u bytes not reachable from its entry, emitted as data.\n",
+            start,
+            func.unreachable_bytes());
+    }
+
+    std::string label = function_label(start);
+    std::string text = ".globl " + label + "\n" + label + ":\n";
+
+    if (spans != nullptr) {
+        spans->add(base + 7, label.c_str(), label.size());
+        spans->add(base + label.size() + 8, label.c_str(), label.size());
+
+        for (auto it = func.symbol_spans().begin(); it != func.symbol_spans().end(); ++it) {
+            spans->add(base + text.size() + it->offset, func.dissassembly().c_str() + it->offset, it->length);
+        }
+    }
+
+    return text + func.dissassembly();
+}
+
 void unassemblize::Executable::dissassemble_gas_func(
     FILE *output, const char *section_name, uint64_t start, uint64_t end)
 {
     if (start != 0 && end != 0) {
-        unassemblize::Function func(*this, section_name, start, end);
-        if (m_outputFormat == OUTPUT_IGAS) {
-            func.disassemble(Function::FORMAT_IGAS);
-        } else {
-            func.disassemble(Function::FORMAT_AGAS);
+        fputs(gas_function_text(section_name, start, end).c_str(), output);
+    }
+}
+
+std::string unassemblize::Executable::function_stamp(const FunctionEntry &entry, const std::string &path) const
+{
+    const SectionInfo *section = find_section(entry.start);
+    std::vector<uint8_t> bytes;
+    std::vector<uint8_t> mask;
+    std::vector<uint64_t> targets;
+    uint64_t hash = 0;
+    normalize_function(*this, entry.start, entry.end, bytes, mask, &targets);
+
+    if (section != nullptr && entry.end > entry.start && entry.end <= section->address + section->size) {
+        hash = fnv1a_64(section->data + (entry.start - section->address), entry.end - entry.start);
+    }
+
+    std::stringstream stream;
+    stream << path << ' ' << function_label(entry.start) << ' ' << std::hex << entry.start << ' ' << entry.end << ' '
+           << hash << '\n';
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+
+    // Besides the bytes the text only depends on the names printed for the addresses they refer to. Targets inside
+    // the function are tagged relative to its start.
+    for (auto it = targets.begin(); it != targets.end(); ++it) {
+        const uint64_t local = uint64_t(1) << 63;
+        const uint64_t target = (*it & local) != 0 ? entry.start + (*it & ~local) : *it;
+        const Symbol *import = get_import(target);
+        auto nearest = m_symbolMap.upper_bound(target);
+
+        if (import != nullptr) {
+            stream << "  " << target << " import " << import->name << '\n';
+        }
+
+        if (nearest != m_symbolMap.begin()) {
+            --nearest;
+            stream << "  " << target << ' ' << nearest->second.name << ' ' << nearest->second.value << '\n';
+        }
+    }
+
+    return stream.str();
+}
+
+bool unassemblize::Executable::write_dependencies(
+    const char *directory, const char *output, const std::vector<std::string> &inputs) const
+{
+    bool success = true;
+
+    // Each depfile has a single target, ninja doesn't accept more.
+    if (directory != nullptr) {
+        for (auto it = m_objectStamps.begin(); it != m_objectStamps.end(); ++it) {
+            std::string depfile = it->substr(0, it->size() - strlen(".syms")) + ".d";
+            success = write_depfile(depfile, std::vector<std::string>(1, *it), inputs) && success;
+        }
+
+        if (m_verbose) {
+            printf("Wrote dependencies for %zu objects to '%s'.\n", m_objectStamps.size(), directory);
+        }
+    }
+
+    if (output != nullptr) {
+        success = write_depfile(std::string(output) + ".d", std::vector<std::string>(1, output), inputs) && success;
+    }
+
+    return success;
+}
+
+void unassemblize::Executable::record_metrics(const Function &func)
+{
+    FunctionMetrics metrics = {};
+    metrics.address = func.start_address();
+    metrics.size = uint32_t(func.end_address() + 1 - func.start_address());
+    metrics.complexity = 1;
+    metrics.blocks = uint32_t(func.blocks().size());
+    metrics.unreachable = func.unreachable_bytes();
+
+    for (auto it = func.instructions().begin(); it != func.instructions().end(); ++it) {
+        if (it->flow == Function::FLOW_CALL) {
+            ++metrics.calls;
+        }
+    }
+
+    // One plus the number of extra ways out of each block, equal to E - N + 2 for single exit graphs without
+    // undercounting functions that return from several places.
+    for (auto it = func.blocks().begin(); it != func.blocks().end(); ++it) {
+        if (it->edge_count > 1) {
+            metrics.complexity += it->edge_count - 1;
+        }
+    }
+
+    std::vector<const std::string *> unresolved;
+
+    for (auto it = func.dependencies().begin(); it != func.dependencies().end(); ++it) {
+        if (is_unresolved(*it)) {
+            unresolved.push_back(&*it);
         }
+    }
+
+    auto less = [](const std::string *a, const std::string *b) { return *a < *b; };
+    auto equal = [](const std::string *a, const std::string *b) { return *a == *b; };
+    std::sort(unresolved.begin(), unresolved.end(), less);
+    metrics.unresolved = uint32_t(std::unique(unresolved.begin(), unresolved.end(), equal) - unresolved.begin());
+
+    m_metrics.push_back(metrics);
+}
+
+bool unassemblize::Executable::save_metrics(const char *file_name) const
+{
+    if (m_verbose) {
+        printf("Saving metrics for %zu functions to '%s'...\n", m_metrics.size(), file_name);
+    }
+
+    FILE *fp = fopen(file_name, "w");
+
+    if (fp == nullptr) {
+        return false;
+    }
+
+    size_t length = strlen(file_name);
+    bool json = length >= 5 && strcasecmp(file_name + length - 5, ".json") == 0;
+
+    fputs(json ? "[\n" : "name,address,size,blocks,calls,complexity,unresolved,unreachable\n", fp);
 
-        const std::string &sym = get_symbol(start).name;
+    for (auto it = m_metrics.begin(); it != m_metrics.end(); ++it) {
+        char buffer[32];
+        const std::string &sym = get_symbol(it->address).name;
+        const char *name = sym.c_str();
 
-        if (!sym.empty()) {
-            fprintf(output,
-                ".globl %s\n%s:\n%s",
-                sym.c_str(),
-                sym.c_str(),
-                func.dissassembly().c_str());
+        if (sym.empty()) {
+            snprintf(buffer, sizeof(buffer), "sub_%" PRIx64, it->address);
+            name = buffer;
+        }
+
+        if (json) {
+            fputs("  {\"name\": ", fp);
+            write_quoted(fp, name, true);
+            fprintf(fp,
+                ", \"address\": %" PRIu64 ", \"size\": %u, \"blocks\": %u, \"calls\": %u, \"complexity\": %u, "
+                "\"unresolved\": %u, \"unreachable\": %u}%s\n",
+                it->address,
+                it->size,
+                it->blocks,
+                it->calls,
+                it->complexity,
+                it->unresolved,
+                it->unreachable,
+                it + 1 != m_metrics.end() ? "," : "");
         } else {
-            fprintf(output,
-                ".globl sub_%" PRIx64 "\nsub_%" PRIx64 ":\n%s",
-                start,
-                start,
-                func.dissassembly().c_str());
+            write_quoted(fp, name, false);
+            fprintf(fp,
+                ",0x%" PRIx64 ",%u,%u,%u,%u,%u,%u\n",
+                it->address,
+                it->size,
+                it->blocks,
+                it->calls,
+                it->complexity,
+                it->unresolved,
+                it->unreachable);
         }
     }
+
+    if (json) {
+        fputs("]\n", fp);
+    }
+
+    fclose(fp);
+
+    return true;
 }
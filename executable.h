@@ -12,12 +12,14 @@
  */
 #pragma once
 
+#include "stringindex.h"
 #include <list>
 #include <map>
 #include <memory>
 #include <nlohmann/json_fwd.hpp>
 #include <stdio.h>
 #include <string>
+#include <vector>
 
 namespace LIEF
 {
@@ -26,6 +28,10 @@ class Binary;
 
 namespace unassemblize
 {
+class AnalysisDatabase;
+class Function;
+class SymbolSpans;
+
 class Executable
 {
 public:
@@ -57,6 +63,26 @@ public:
         uint64_t size;
     };
 
+    struct FunctionEntry
+    {
+        uint64_t start;
+        uint64_t end; // Exclusive end address, 0 while it still has to be inferred.
+    };
+
+    /**
+     * Per function statistics gathered while dissassembling, used to prioritise work.
+     */
+    struct FunctionMetrics
+    {
+        uint64_t address;
+        uint32_t size;
+        uint32_t blocks;
+        uint32_t calls;
+        uint32_t complexity; // Cyclomatic complexity.
+        uint32_t unresolved; // Distinct sub_, off_ and unk_ references.
+        uint32_t unreachable; // Bytes not reachable from the entry, usually a sign of a wrong end address.
+    };
+
     struct ObjectSection
     {
         std::string name;
@@ -79,7 +105,69 @@ public:
     uint64_t base_address() const;
     uint64_t end_address() const { return m_endAddress; };
     const Symbol &get_symbol(uint64_t addr) const;
+    const std::map<uint64_t, Symbol> &symbols() const { return m_symbolMap; }
     const Symbol &get_nearest_symbol(uint64_t addr) const;
+    /**
+     * Returns the import bound to an import address table slot or nullptr if addr isn't a slot.
+     * Backed by a dense array over the IAT so operand formatting only costs a single indexed load.
+     */
+    const Symbol *get_import(uint64_t addr) const
+    {
+        uint64_t offset = addr - m_iatStart;
+
+        if (offset >= m_iatSize || (offset & (m_pointerSize - 1)) != 0) {
+            return nullptr;
+        }
+
+        return m_iatIndex[offset >> m_pointerShift];
+    }
+    uint32_t pointer_size() const { return m_pointerSize; }
+    /**
+     * Sorted table of known function ranges.
+     */
+    const std::vector<FunctionEntry> &functions() const { return m_functions; }
+    /**
+     * Returns the function containing addr or nullptr if it isn't covered by the function table.
+     */
+    const FunctionEntry *find_function(uint64_t addr) const;
+    /**
+     * Returns the section containing addr or nullptr.
+     */
+    const SectionInfo *find_section(uint64_t addr) const;
+    /**
+     * Checks if addr is the location of a relocation, always false if the binary has no relocations.
+     */
+    bool is_relocated(uint64_t addr) const;
+    bool has_relocations() const { return !m_relocations.empty(); }
+    /**
+     * Queues an address as a function start candidate for the next discover_functions run.
+     */
+    void queue_function(uint64_t addr) { m_functionQueue.push_back(addr); }
+    /**
+     * Scans code sections for function start candidates and merges them with the unwind derived table.
+     * Should be called after the config is loaded so the section types are final.
+     */
+    void discover_functions();
+    /**
+     * Adds the symbols discover_functions derives from the binary itself, import thunk names and vtable and slot names
+     * from RTTI, without touching the function table. Runs at most once and after the config is loaded, so names from
+     * the config take precedence. discover_functions calls it, a saved analysis has to call it itself.
+     */
+    void recover_symbols();
+    /**
+     * Replaces the function table, used when it comes from a saved analysis instead of discover_functions.
+     */
+    void set_functions(const std::vector<FunctionEntry> &functions);
+    /**
+     * Saved analysis matching the function table, dissassembly and folding use it instead of decoding again.
+     */
+    void set_analysis(const AnalysisDatabase *analysis) { m_analysis = analysis; }
+    const AnalysisDatabase *analysis() const { return m_analysis; }
+    /**
+     * Builds the index of string literals in data sections, searchable also builds the substring search index.
+     */
+    void index_strings(bool searchable = false);
+    const StringIndex &strings() const { return m_strings; }
     void add_symbol(const char *sym, uint64_t addr);
     void load_config(const char *file_name);
     void save_config(const char *file_name);
@@ -88,9 +176,105 @@ public:
      * Addresses should be the absolute addresses when the binary is loaded at its preferred base address.
      */
     void dissassemble_function(FILE *output, const char *section_name, uint64_t start, uint64_t end);
+    /**
+     * The text dissassemble_function writes for a range, empty for MASM output.
+     */
+    std::string function_text(const char *section_name, uint64_t start, uint64_t end);
+    /**
+     * Object the config assigns the address to, the name of the binary if no object claims it.
+     */
+    std::string object_name(const char *section_name, uint64_t address) const;
+    /**
+     * Dissassembles every function from the function table that lies within the named section. With fold set, functions
+     * whose normalized bodies and references match an earlier one are emitted as an alias of it instead. With index set,
+     * a tab separated line giving each function's name, address and byte offset and length in output is written to it.
+     * With spans set, the offset of every symbol name written is added to it for the file added last.
+     */
+    void dissassemble_functions(FILE *output,
+        const char *section_name,
+        bool fold = false,
+        FILE *index = nullptr,
+        SymbolSpans *spans = nullptr);
+    /**
+     * Writes every function of the named section to its own file, directory/<object>/<symbol>.S, and lists them in
+     * directory/manifest.json. Returns false if any file couldn't be written. With spans set, each file is added to it
+     * with the offsets of the symbol names written to it. Nothing is folded, every file is assembled into its own
+     * object and an alias there couldn't refer to a body defined in another one. With incremental set, writes
+     * directory/<object>.syms describing the bytes and symbol names each object's files are formatted from and skips
+     * objects whose stamp and files are unchanged. Files whose text didn't change are never rewritten.
+     */
+    bool dissassemble_to_directory(
+        const char *directory, const char *section_name, SymbolSpans *spans = nullptr, bool incremental = false);
+    /**
+     * Metrics of every function dissassembled so far.
+     */
+    const std::vector<FunctionMetrics> &metrics() const { return m_metrics; }
+    /**
+     * Writes the collected metrics as JSON if the file name ends in .json and as CSV otherwise.
+     */
+    bool save_metrics(const char *file_name) const;
+    /**
+     * Writes make depfiles with a single target each listing inputs as its prerequisites. With directory set that is
+     * directory/<object>.d for the stamp of every object an incremental dissassemble_to_directory wrote, with output
+     * set it is output.d for output.
+     */
+    bool write_dependencies(const char *directory, const char *output, const std::vector<std::string> &inputs) const;
 
 private:
     void dissassemble_gas_func(FILE *output, const char *section_name, uint64_t start, uint64_t end);
+    std::string gas_function_text(
+        const char *section_name, uint64_t start, uint64_t end, SymbolSpans *spans = nullptr, uint64_t base = 0);
+    std::string function_stamp(const FunctionEntry &entry, const std::string &path) const;
+    std::string alias_text(
+        const char *section_name, uint64_t address, uint64_t canonical, SymbolSpans *spans, uint64_t base);
+    std::string function_label(uint64_t address) const;
+    std::vector<const FunctionEntry *> section_functions(const char *section_name) const;
+    /**
+     * Index of the first function with the same normalized body and references for each function, its own index if
+     * there is none.
+     */
+    std::vector<size_t> find_duplicates(const std::vector<const FunctionEntry *> &functions) const;
+    void record_metrics(const Function &func);
+
+    /**
+     * Adds symbols for imports and builds the dense IAT slot index for PE binaries.
+     */
+    void index_imports();
+    /**
+     * Names jmp [IAT slot] thunks in code sections as j_<import>.
+     */
+    void find_import_thunks();
+    /**
+     * Fills the function table from x64 PE .pdata and ELF .eh_frame unwind tables.
+     */
+    void load_unwind_info();
+    void load_pdata(const SectionInfo &section);
+    void load_eh_frame(const SectionInfo &section);
+    /**
+     * Part of a data section, parallel scans over data sections hand these out to workers.
+     */
+    struct DataChunk
+    {
+        const SectionInfo *section;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    std::vector<DataChunk> data_chunks() const;
+    void load_relocations();
+    void scan_code_prologues();
+    /**
+     * Queues targets of pointers stored in data sections, vtables and callback tables mostly.
+     */
+    void scan_code_pointers();
+    /**
+     * Locates MSVC RTTI complete object locators and names the vtables referencing them and their slots.
+     */
+    void recover_vtables();
+    /**
+     * Merges queued candidates into the function table and infers missing end addresses.
+     */
+    void build_function_table();
 
     void load_symbols(nlohmann::json &js);
     /**
@@ -114,10 +298,23 @@ private:
     std::map<uint64_t, Symbol> m_symbolMap;
     std::list<std::string> m_loadedSymbols;
     std::list<Object> m_targetObjects;
+    std::vector<FunctionEntry> m_functions;
+    std::vector<uint64_t> m_functionQueue;
+    bool m_symbolsRecovered = false;
+    const AnalysisDatabase *m_analysis = nullptr;
+    std::vector<uint64_t> m_relocations; // Sorted addresses of relocated locations.
+    std::vector<FunctionMetrics> m_metrics;
+    std::vector<std::string> m_objectStamps; // Stamp files written by dissassemble_to_directory.
+    StringIndex m_strings;
+    std::vector<const Symbol *> m_iatIndex; // Import symbol for each IAT slot, nullptr for unused slots.
     OutputFormats m_outputFormat;
     uint64_t m_endAddress;
+    uint64_t m_iatStart;
+    uint64_t m_iatSize;
     uint32_t m_codeAlignment;
     uint32_t m_dataAlignment;
+    uint32_t m_pointerSize;
+    uint32_t m_pointerShift;
     uint8_t m_codePad;
     uint8_t m_dataPad;
     bool m_verbose;
@@ -1,6 +1,9 @@
 #include "function.h"
+#include "scan.h"
 #include <Zydis/Zydis.h>
+#include <algorithm>
 #include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sstream>
 #include <Zycore/Format.h>
@@ -12,6 +15,87 @@ uint32_t get_le32(const uint8_t *data)
     return (data[3] << 24) | (data[2] << 16) | (data[1] << 8) | data[0];
 }
 
+uint8_t flow_type(const ZydisDecodedInstruction &info)
+{
+    switch (info.meta.category) {
+        case ZYDIS_CATEGORY_CALL:
+            return unassemblize::Function::FLOW_CALL;
+        case ZYDIS_CATEGORY_COND_BR:
+            return unassemblize::Function::FLOW_BRANCH;
+        case ZYDIS_CATEGORY_UNCOND_BR:
+            return unassemblize::Function::FLOW_JUMP;
+        case ZYDIS_CATEGORY_RET:
+            return unassemblize::Function::FLOW_RETURN;
+        default:
+            break;
+    }
+
+    switch (info.mnemonic) {
+        case ZYDIS_MNEMONIC_INT3:
+        case ZYDIS_MNEMONIC_HLT:
+        case ZYDIS_MNEMONIC_UD2:
+            return unassemblize::Function::FLOW_RETURN;
+        default:
+            return unassemblize::Function::FLOW_NORMAL;
+    }
+}
+
+// Change of ESP caused by an instruction, call cleanup is left to the caller as it depends on the convention.
+int32_t stack_effect(const ZydisDisassembledInstruction &instruction)
+{
+    const ZydisDecodedInstruction &info = instruction.info;
+    const ZydisDecodedOperand *operands = instruction.operands;
+    const bool writes_esp = info.operand_count_visible > 0 && operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER
+        && operands[0].reg.value == ZYDIS_REGISTER_ESP;
+
+    switch (info.mnemonic) {
+        case ZYDIS_MNEMONIC_PUSH:
+            return -int32_t(info.operand_width / 8);
+        case ZYDIS_MNEMONIC_POP:
+            return writes_esp ? unassemblize::Function::STACK_UNKNOWN : int32_t(info.operand_width / 8);
+        case ZYDIS_MNEMONIC_PUSHAD:
+            return -32;
+        case ZYDIS_MNEMONIC_POPAD:
+            return 32;
+        case ZYDIS_MNEMONIC_PUSHFD:
+            return -4;
+        case ZYDIS_MNEMONIC_POPFD:
+            return 4;
+        case ZYDIS_MNEMONIC_CALL:
+            return 0;
+        case ZYDIS_MNEMONIC_RET:
+            if (info.operand_count_visible > 0 && operands[0].type == ZYDIS_OPERAND_TYPE_IMMEDIATE) {
+                return 4 + int32_t(operands[0].imm.value.u);
+            }
+
+            return 4;
+        case ZYDIS_MNEMONIC_SUB:
+        case ZYDIS_MNEMONIC_ADD:
+            if (writes_esp && operands[1].type == ZYDIS_OPERAND_TYPE_IMMEDIATE) {
+                const int32_t value = int32_t(operands[1].imm.value.s);
+                return info.mnemonic == ZYDIS_MNEMONIC_SUB ? -value : value;
+            }
+            break;
+        case ZYDIS_MNEMONIC_LEA:
+            if (writes_esp && operands[1].mem.base == ZYDIS_REGISTER_ESP && operands[1].mem.index == ZYDIS_REGISTER_NONE) {
+                return int32_t(operands[1].mem.disp.value);
+            }
+            break;
+        default:
+            break;
+    }
+
+    // Anything else writing ESP, like mov esp, ebp or and esp, -16, loses track of the frame.
+    for (unsigned i = 0; i < info.operand_count; ++i) {
+        if (operands[i].type == ZYDIS_OPERAND_TYPE_REGISTER && operands[i].reg.value == ZYDIS_REGISTER_ESP
+            && (operands[i].actions & ZYDIS_OPERAND_ACTION_MASK_WRITE)) {
+            return unassemblize::Function::STACK_UNKNOWN;
+        }
+    }
+
+    return 0;
+}
+
 // Copy of the disassmble function without any formatting.
 static ZyanStatus UnasmDisassembleNoFormat(ZydisMachineMode machine_mode, ZyanU64 runtime_address, const void *buffer,
     ZyanUSize length, ZydisDisassembledInstruction *instruction)
@@ -53,6 +137,65 @@ static ZyanStatus UnasmDisassembleNoFormat(ZydisMachineMode machine_mode, ZyanU6
     return ZYAN_STATUS_SUCCESS;
 }
 
+// Strings referenced through off_ operands get their contents as a comment to keep the output readable.
+void add_string_comment(unassemblize::Function *func, uint64_t address)
+{
+    const unassemblize::StringIndex::Entry *entry = func->executable().strings().find(address);
+
+    if (entry == nullptr) {
+        return;
+    }
+
+    const size_t max_length = 64;
+    std::string text = func->executable().strings().text(*entry);
+    std::string comment = entry->wide ? "L\"" : "\"";
+
+    for (size_t i = 0; i < text.size() && i < max_length; ++i) {
+        switch (text[i]) {
+            case '\n':
+                comment += "\\n";
+                break;
+            case '\r':
+                comment += "\\r";
+                break;
+            case '\t':
+                comment += "\\t";
+                break;
+            case '"':
+            case '\\':
+                comment += '\\';
+                comment += text[i];
+                break;
+            default:
+                comment += text[i];
+                break;
+        }
+    }
+
+    comment += text.size() > max_length ? "\"..." : "\"";
+    func->add_comment(comment);
+}
+
+// Appends prefix, name and suffix, remembering where the name went so it can be renamed in the output later and
+// which operand it stands for so the text can be checked against the original bytes.
+ZyanStatus append_symbol(unassemblize::Function *func,
+    ZydisFormatterContext *context,
+    ZyanString *string,
+    const char *prefix,
+    const char *name,
+    const char *suffix = "")
+{
+    ZyanUSize size;
+    ZYAN_CHECK(ZyanStringGetSize(string, &size));
+    func->add_symbol_span(uint32_t(size + strlen(prefix)), uint32_t(strlen(name)));
+
+    // Only displacements print an offset after the name, as +0x followed by the hex difference.
+    const uint64_t addend = strncmp(suffix, "+0x", 3) == 0 ? strtoull(suffix + 3, nullptr, 16) : 0;
+    func->add_operand_symbol(context->runtime_address, context->operand->id, name, addend);
+
+    return ZyanStringAppendFormat(string, "%s%s%s", prefix, name, suffix);
+}
+
 ZydisFormatterFunc default_print_address_absolute;
 
 static ZyanStatus UnasmFormatterPrintAddressAbsolute(
@@ -69,7 +212,7 @@ static ZyanStatus UnasmFormatterPrintAddressAbsolute(
         ZyanString *string;
         ZYAN_CHECK(ZydisFormatterBufferGetString(buffer, &string));
         auto it = func->labels().find(address);
-        return ZyanStringAppendFormat(string, "%s", symbol.name.c_str());
+        return append_symbol(func, context, string, "", symbol.name.c_str());
     } else if (address >= func->section_address() && address <= func->section_end()) {
         // Probably a function if the address is in the current section.
         ZYAN_CHECK(ZydisFormatterBufferAppend(buffer, ZYDIS_TOKEN_SYMBOL));
@@ -79,13 +222,13 @@ static ZyanStatus UnasmFormatterPrintAddressAbsolute(
 
         if (!symbol.name.empty()) {
             func->add_dependency(symbol.name);
-            return ZyanStringAppendFormat(string, "%s", symbol.name.c_str());
+            return append_symbol(func, context, string, "", symbol.name.c_str());
         }
 
         snprintf(hex_buff, sizeof(hex_buff), "sub_%" PRIx64, address);
         func->add_dependency(hex_buff);
 
-        return ZyanStringAppendFormat(string, "sub_%" PRIx64, address);
+        return append_symbol(func, context, string, "", hex_buff);
     } else if (address >= func->executable().base_address() && address <= func->executable().end_address()) {
         // Data is in another section?
         ZYAN_CHECK(ZydisFormatterBufferAppend(buffer, ZYDIS_TOKEN_SYMBOL));
@@ -95,13 +238,14 @@ static ZyanStatus UnasmFormatterPrintAddressAbsolute(
 
         if (!symbol.name.empty()) {
             func->add_dependency(symbol.name);
-            return ZyanStringAppendFormat(string, "%s", symbol.name.c_str());
+            return append_symbol(func, context, string, "", symbol.name.c_str());
         }
 
         snprintf(hex_buff, sizeof(hex_buff), "off_%" PRIx64, address);
         func->add_dependency(hex_buff);
+        add_string_comment(func, address);
 
-        return ZyanStringAppendFormat(string, "off_%" PRIx64, address);
+        return append_symbol(func, context, string, "", hex_buff);
     }
 
     return default_print_address_absolute(formatter, buffer, context);
@@ -123,7 +267,7 @@ static ZyanStatus UnasmFormatterPrintAddressRelative(
         ZyanString *string;
         ZYAN_CHECK(ZydisFormatterBufferGetString(buffer, &string));
         auto it = func->labels().find(address);
-        return ZyanStringAppendFormat(string, "%s", symbol.name.c_str());
+        return append_symbol(func, context, string, "", symbol.name.c_str());
     } else if (address >= func->section_address() && address <= func->section_end()) {
         // Probably a function if the address is in the current section.
         ZYAN_CHECK(ZydisFormatterBufferAppend(buffer, ZYDIS_TOKEN_SYMBOL));
@@ -133,13 +277,13 @@ static ZyanStatus UnasmFormatterPrintAddressRelative(
 
         if (!symbol.name.empty()) {
             func->add_dependency(symbol.name);
-            return ZyanStringAppendFormat(string, "%s", symbol.name.c_str());
+            return append_symbol(func, context, string, "", symbol.name.c_str());
         }
 
         snprintf(hex_buff, sizeof(hex_buff), "sub_%" PRIx64, address);
         func->add_dependency(hex_buff);
 
-        return ZyanStringAppendFormat(string, "sub_%" PRIx64, address);
+        return append_symbol(func, context, string, "", hex_buff);
     } else if (address >= func->executable().base_address() && address <= func->executable().end_address()) {
         // Data if in another section?
         ZYAN_CHECK(ZydisFormatterBufferAppend(buffer, ZYDIS_TOKEN_SYMBOL));
@@ -149,13 +293,14 @@ static ZyanStatus UnasmFormatterPrintAddressRelative(
 
         if (!symbol.name.empty()) {
             func->add_dependency(symbol.name);
-            return ZyanStringAppendFormat(string, "%s", symbol.name.c_str());
+            return append_symbol(func, context, string, "", symbol.name.c_str());
         }
 
         snprintf(hex_buff, sizeof(hex_buff), "off_%" PRIx64, address);
         func->add_dependency(hex_buff);
+        add_string_comment(func, address);
 
-        return ZyanStringAppendFormat(string, "off_%" PRIx64, address);
+        return append_symbol(func, context, string, "", hex_buff);
     }
 
     return default_print_address_relative(formatter, buffer, context);
@@ -176,7 +321,7 @@ static ZyanStatus UnasmFormatterPrintIMM(
         ZyanString *string;
         ZYAN_CHECK(ZydisFormatterBufferGetString(buffer, &string));
         auto it = func->labels().find(address);
-        return ZyanStringAppendFormat(string, "offset %s", symbol.name.c_str());
+        return append_symbol(func, context, string, "offset ", symbol.name.c_str());
     } else if (address >= func->section_address() && address <= func->section_end()) {
         // Probably a function if the address is in the current section.
         ZYAN_CHECK(ZydisFormatterBufferAppend(buffer, ZYDIS_TOKEN_SYMBOL));
@@ -186,13 +331,13 @@ static ZyanStatus UnasmFormatterPrintIMM(
 
         if (!symbol.name.empty()) {
             func->add_dependency(symbol.name);
-            return ZyanStringAppendFormat(string, "offset %s", symbol.name.c_str());
+            return append_symbol(func, context, string, "offset ", symbol.name.c_str());
         }
 
         snprintf(hex_buff, sizeof(hex_buff), "offset sub_%" PRIx64, address);
         func->add_dependency(hex_buff);
 
-        return ZyanStringAppendFormat(string, "offset sub_%" PRIx64, address);
+        return append_symbol(func, context, string, "offset ", hex_buff + 7);
     } else if (address >= func->executable().base_address() && address <= (func->executable().end_address())) {
         // Data if in another section?
         ZYAN_CHECK(ZydisFormatterBufferAppend(buffer, ZYDIS_TOKEN_SYMBOL));
@@ -202,13 +347,14 @@ static ZyanStatus UnasmFormatterPrintIMM(
 
         if (!symbol.name.empty()) {
             func->add_dependency(symbol.name);
-            return ZyanStringAppendFormat(string, "offset %s", symbol.name.c_str());
+            return append_symbol(func, context, string, "offset ", symbol.name.c_str());
         }
 
         snprintf(hex_buff, sizeof(hex_buff), "offset off_%" PRIx64, address);
         func->add_dependency(hex_buff);
+        add_string_comment(func, address);
 
-        return ZyanStringAppendFormat(string, "offset off_%" PRIx64, address);
+        return append_symbol(func, context, string, "offset ", hex_buff + 7);
     }
 
     return default_print_immediate(formatter, buffer, context);
@@ -229,7 +375,7 @@ static ZyanStatus UnasmFormatterPrintDISP(
         ZyanString *string;
         ZYAN_CHECK(ZydisFormatterBufferGetString(buffer, &string));
         auto it = func->labels().find(address);
-        return ZyanStringAppendFormat(string, "+%s", symbol.name.c_str());
+        return append_symbol(func, context, string, "+", symbol.name.c_str());
     } else if (address >= func->section_address() && address <= func->section_end()) {
         // Probably a function if the address is in the current section.
         ZYAN_CHECK(ZydisFormatterBufferAppend(buffer, ZYDIS_TOKEN_SYMBOL));
@@ -241,17 +387,18 @@ static ZyanStatus UnasmFormatterPrintDISP(
             func->add_dependency(symbol.name);
 
             if (symbol.value == address) {
-                return ZyanStringAppendFormat(string, "+%s", symbol.name.c_str());
+                return append_symbol(func, context, string, "+", symbol.name.c_str());
             } else {
                 uint64_t diff = address - symbol.value; // value should always be lower than requested address.
-                return ZyanStringAppendFormat(string, "+%s+0x%" PRIx64, symbol.name.c_str(), diff);
+                snprintf(hex_buff, sizeof(hex_buff), "+0x%" PRIx64, diff);
+                return append_symbol(func, context, string, "+", symbol.name.c_str(), hex_buff);
             }
         }
 
         snprintf(hex_buff, sizeof(hex_buff), "sub_%" PRIx64, address);
         func->add_dependency(hex_buff);
 
-        return ZyanStringAppendFormat(string, "+sub_%" PRIx64, address);
+        return append_symbol(func, context, string, "+", hex_buff);
     } else if (address >= func->executable().base_address() && address <= (func->executable().end_address())) {
         // Data if in another section?
         ZYAN_CHECK(ZydisFormatterBufferAppend(buffer, ZYDIS_TOKEN_SYMBOL));
@@ -263,17 +410,19 @@ static ZyanStatus UnasmFormatterPrintDISP(
             func->add_dependency(symbol.name);
 
             if (symbol.value == address) {
-                return ZyanStringAppendFormat(string, "+%s", symbol.name.c_str());
+                return append_symbol(func, context, string, "+", symbol.name.c_str());
             } else {
                 uint64_t diff = address - symbol.value; // value should always be lower than requested address.
-                return ZyanStringAppendFormat(string, "+%s+0x%" PRIx64, symbol.name.c_str(), diff);
+                snprintf(hex_buff, sizeof(hex_buff), "+0x%" PRIx64, diff);
+                return append_symbol(func, context, string, "+", symbol.name.c_str(), hex_buff);
             }
         }
 
         snprintf(hex_buff, sizeof(hex_buff), "off_%" PRIx64, address);
         func->add_dependency(hex_buff);
+        add_string_comment(func, address);
 
-        return ZyanStringAppendFormat(string, "+off_%" PRIx64, address);
+        return append_symbol(func, context, string, "+", hex_buff);
     }
 
     return default_print_displacement(formatter, buffer, context);
@@ -294,7 +443,7 @@ static ZyanStatus UnasmFormatterFormatOperandPTR(
         ZyanString *string;
         ZYAN_CHECK(ZydisFormatterBufferGetString(buffer, &string));
         auto it = func->labels().find(address);
-        return ZyanStringAppendFormat(string, "%s", symbol.name.c_str());
+        return append_symbol(func, context, string, "", symbol.name.c_str());
     } else if (address >= func->section_address() && address <= func->section_end()) {
         // Probably a function if the address is in the current section.
         ZYAN_CHECK(ZydisFormatterBufferAppend(buffer, ZYDIS_TOKEN_SYMBOL));
@@ -304,13 +453,13 @@ static ZyanStatus UnasmFormatterFormatOperandPTR(
 
         if (!symbol.name.empty()) {
             func->add_dependency(symbol.name);
-            return ZyanStringAppendFormat(string, "%s", symbol.name.c_str());
+            return append_symbol(func, context, string, "", symbol.name.c_str());
         }
 
         snprintf(hex_buff, sizeof(hex_buff), "sub_%" PRIx64, address);
         func->add_dependency(hex_buff);
 
-        return ZyanStringAppendFormat(string, "sub_%" PRIx64, address);
+        return append_symbol(func, context, string, "", hex_buff);
     } else if (address >= func->executable().base_address() && address <= func->executable().end_address()) {
         // Data if in another section?
         ZYAN_CHECK(ZydisFormatterBufferAppend(buffer, ZYDIS_TOKEN_SYMBOL));
@@ -320,13 +469,13 @@ static ZyanStatus UnasmFormatterFormatOperandPTR(
 
         if (!symbol.name.empty()) {
             func->add_dependency(symbol.name);
-            return ZyanStringAppendFormat(string, "%s", symbol.name.c_str());
+            return append_symbol(func, context, string, "", symbol.name.c_str());
         }
 
         snprintf(hex_buff, sizeof(hex_buff), "unk_%" PRIx64, address);
         func->add_dependency(hex_buff);
 
-        return ZyanStringAppendFormat(string, "unk_%" PRIx64, address);
+        return append_symbol(func, context, string, "", hex_buff);
     }
 
     return default_format_operand_ptr(formatter, buffer, context);
@@ -340,7 +489,42 @@ static ZyanStatus UnasmFormatterFormatOperandMEM(
     unassemblize::Function *func = static_cast<unassemblize::Function *>(context->user_data);
     uint64_t address = context->operand->mem.disp.value;
     char hex_buff[32];
-    const unassemblize::Executable::Symbol &symbol = func->executable().get_symbol(address);
+    const unassemblize::Executable::Symbol *import = nullptr;
+    const char *prefix = "[";
+
+    // Absolute operands are checked against the dense IAT index first, call [slot] and thunks are very common.
+    if (context->operand->mem.base == ZYDIS_REGISTER_NONE && context->operand->mem.index == ZYDIS_REGISTER_NONE) {
+        import = func->executable().get_import(address);
+    } else if (context->operand->mem.base == ZYDIS_REGISTER_RIP) {
+        // On x64 the slot is addressed relative to the next instruction, the name keeps the rip base.
+        uint64_t slot;
+
+        if (ZYAN_SUCCESS(
+                ZydisCalcAbsoluteAddress(context->instruction, context->operand, context->runtime_address, &slot))) {
+            import = func->executable().get_import(slot);
+        }
+
+        if (import != nullptr) {
+            prefix = "[rip + ";
+        }
+    } else if (context->operand->mem.base == ZYDIS_REGISTER_ESP && context->operand->mem.index == ZYDIS_REGISTER_NONE
+        && func->stack_delta() != unassemblize::Function::STACK_UNKNOWN) {
+        // Name the slot relative to the entry ESP, the return address sits at 0 and arguments above it.
+        const int64_t slot = func->stack_delta() + context->operand->mem.disp.value;
+
+        if (slot == 0) {
+            func->add_comment("retaddr");
+        } else if (slot > 0) {
+            snprintf(hex_buff, sizeof(hex_buff), "arg_%" PRIx64, uint64_t(slot - 4));
+            func->add_comment(hex_buff);
+        } else {
+            snprintf(hex_buff, sizeof(hex_buff), "var_%" PRIx64, uint64_t(-slot));
+            func->add_comment(hex_buff);
+        }
+    }
+
+    const unassemblize::Executable::Symbol &symbol =
+        import != nullptr ? *import : func->executable().get_symbol(address);
 
     if ((context->operand->mem.type == ZYDIS_MEMOP_TYPE_MEM) || (context->operand->mem.type == ZYDIS_MEMOP_TYPE_VSIB)) {
         ZYAN_CHECK(formatter->func_print_typecast(formatter, buffer, context));
@@ -352,7 +536,7 @@ static ZyanStatus UnasmFormatterFormatOperandMEM(
         ZyanString *string;
         ZYAN_CHECK(ZydisFormatterBufferGetString(buffer, &string));
         auto it = func->labels().find(address);
-        return ZyanStringAppendFormat(string, "[%s]", symbol.name.c_str());
+        return append_symbol(func, context, string, prefix, symbol.name.c_str(), "]");
     } else if (address >= func->section_address() && address <= func->section_end()) {
         // Probably a function if the address is in the current section.
         ZYAN_CHECK(ZydisFormatterBufferAppend(buffer, ZYDIS_TOKEN_SYMBOL));
@@ -362,13 +546,13 @@ static ZyanStatus UnasmFormatterFormatOperandMEM(
 
         if (!symbol.name.empty()) {
             func->add_dependency(symbol.name);
-            return ZyanStringAppendFormat(string, "[%s]", symbol.name.c_str());
+            return append_symbol(func, context, string, "[", symbol.name.c_str(), "]");
         }
 
         snprintf(hex_buff, sizeof(hex_buff), "sub_%" PRIx64, address);
         func->add_dependency(hex_buff);
 
-        return ZyanStringAppendFormat(string, "[sub_%" PRIx64 "]", address);
+        return append_symbol(func, context, string, "[", hex_buff, "]");
     } else if (address >= func->executable().base_address() && address <= func->executable().end_address()) {
         // Data if in another section?
         ZYAN_CHECK(ZydisFormatterBufferAppend(buffer, ZYDIS_TOKEN_SYMBOL));
@@ -378,13 +562,13 @@ static ZyanStatus UnasmFormatterFormatOperandMEM(
 
         if (!symbol.name.empty()) {
             func->add_dependency(symbol.name);
-            return ZyanStringAppendFormat(string, "[%s]", symbol.name.c_str());
+            return append_symbol(func, context, string, "[", symbol.name.c_str(), "]");
         }
 
         snprintf(hex_buff, sizeof(hex_buff), "unk_%" PRIx64, address);
         func->add_dependency(hex_buff);
 
-        return ZyanStringAppendFormat(string, "[unk_%" PRIx64 "]", address);
+        return append_symbol(func, context, string, "[", hex_buff, "]");
     }
 
     return default_format_operand_mem(formatter, buffer, context);
@@ -487,83 +671,211 @@ static ZyanStatus UnasmDisassembleCustom(ZydisMachineMode machine_mode, ZyanU64
 
     return ZYAN_STATUS_SUCCESS;
 }
+
+// mov ebp, esp
+bool is_frame_pointer_setup(const ZydisDisassembledInstruction &instruction)
+{
+    const ZydisDecodedOperand *operands = instruction.operands;
+
+    return instruction.info.mnemonic == ZYDIS_MNEMONIC_MOV && operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER
+        && operands[0].reg.value == ZYDIS_REGISTER_EBP && operands[1].type == ZYDIS_OPERAND_TYPE_REGISTER
+        && operands[1].reg.value == ZYDIS_REGISTER_ESP;
+}
+
+// Decode in the mode of the image, .pdata and .eh_frame add functions of 64 bit binaries too.
+ZydisMachineMode machine_mode(const unassemblize::Executable &exe)
+{
+    return exe.pointer_size() == sizeof(uint64_t) ? ZYDIS_MACHINE_MODE_LONG_64 : ZYDIS_MACHINE_MODE_LEGACY_32;
+}
 } // namespace
 
-void unassemblize::Function::disassemble(AsmFormat fmt)
+void unassemblize::Function::analyse()
 {
+    m_instructions.clear();
+    m_jumpTables.clear();
+    m_labels.clear();
+    m_analysed = true;
+
     if (m_executable.section_size(m_section.c_str()) == 0) {
         return;
     }
 
-    static bool in_jump_table;
-
     ZyanUSize offset = m_startAddress - m_executable.section_address(m_section.c_str());
     uint64_t runtime_address = m_startAddress;
     ZyanUSize end_offset = m_endAddress - m_executable.section_address(m_section.c_str());
     ZydisDisassembledInstruction instruction;
+    int32_t pushed = 0; // Bytes pushed since the last call, assumed to be its arguments.
+    bool in_prologue = true;
+    const bool is_64 = m_executable.pointer_size() == sizeof(uint64_t);
 
-    in_jump_table = false;
-
-    // Loop through function once to identify all jumps to local labels and create them.
-    while (ZYAN_SUCCESS(UnasmDisassembleNoFormat(ZYDIS_MACHINE_MODE_LEGACY_32,
+    // Loop through function once to record the instruction stream and inline jump tables.
+    while (ZYAN_SUCCESS(UnasmDisassembleNoFormat(machine_mode(m_executable),
                runtime_address,
                m_executable.section_data(m_section.c_str()) + offset,
                96,
                &instruction))
         && offset <= end_offset) {
         uint64_t address;
+        InstructionInfo info;
+        info.offset = uint32_t(runtime_address - m_startAddress);
+        info.target = UINT32_MAX;
+        info.length = instruction.info.length;
+        info.flow = flow_type(instruction.info);
+        // Stack slots are only tracked for 32 bit code, where ESP is the register the effects are counted on.
+        info.stack = is_64 ? int32_t(STACK_UNKNOWN) : stack_effect(instruction);
+        info.reachable = false;
+
+        const ZydisMnemonic mnemonic = instruction.info.mnemonic;
+        const bool is_push_pop = mnemonic == ZYDIS_MNEMONIC_PUSH || mnemonic == ZYDIS_MNEMONIC_POP;
+        const bool is_frame_setup = is_frame_pointer_setup(instruction) || (!is_push_pop && info.stack != 0);
+
+        // Register saves and frame setup at the entry aren't arguments of the first call.
+        in_prologue = in_prologue
+            && (is_frame_setup
+                || (mnemonic == ZYDIS_MNEMONIC_PUSH && instruction.operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER));
+
+        if (info.flow == FLOW_CALL) {
+            // Assume the callee pops its arguments as stdcall and thiscall do, undone below for caller cleanup.
+            info.stack = pushed;
+            pushed = 0;
+        } else if (info.flow != FLOW_NORMAL || info.stack == STACK_UNKNOWN || in_prologue) {
+            pushed = 0;
+        } else if (mnemonic == ZYDIS_MNEMONIC_ADD && info.stack > 0 && !m_instructions.empty()
+            && m_instructions.back().flow == FLOW_CALL) {
+            m_instructions.back().stack = 0;
+        } else if (is_push_pop) {
+            pushed = pushed > info.stack ? pushed - info.stack : 0;
+        } else if (is_frame_setup) {
+            // Only the pushes after the last explicit adjustment of ESP are taken as arguments.
+            pushed = 0;
+        }
 
         if (instruction.info.raw.imm->is_relative) {
             ZydisCalcAbsoluteAddress(&instruction.info, instruction.operands, runtime_address, &address);
 
-            if (address >= m_startAddress && address <= m_endAddress && m_labels.find(address) == m_labels.end()) {
-                std::stringstream stream;
-                stream << std::hex << address;
-                m_labels[address] = std::string("loc_") + stream.str();
-                m_executable.add_symbol(m_labels[address].c_str(), address);
+            if (address >= m_startAddress && address <= m_endAddress) {
+                info.target = uint32_t(address - m_startAddress);
+            }
+        } else if (info.flow == FLOW_JUMP
+            && (instruction.operands[0].type == ZYDIS_OPERAND_TYPE_REGISTER
+                || (instruction.operands[0].type == ZYDIS_OPERAND_TYPE_MEMORY
+                    && instruction.operands[0].mem.index != ZYDIS_REGISTER_NONE))) {
+            // jmp reg or jmp [table + reg * 4], the table itself is picked up below or after a later nop.
+            info.flow = FLOW_SWITCH;
+
+            if (instruction.operands[0].type == ZYDIS_OPERAND_TYPE_MEMORY
+                && instruction.operands[0].mem.base == ZYDIS_REGISTER_NONE) {
+                address = uint64_t(instruction.operands[0].mem.disp.value);
+
+                if (address >= m_startAddress && address <= m_endAddress) {
+                    info.target = uint32_t(address - m_startAddress);
+                }
             }
         }
 
+        m_instructions.push_back(info);
         offset += instruction.info.length;
         runtime_address += instruction.info.length;
 
         // If instruction is a nop or jmp, could be at an inline jump table.
         if (instruction.info.mnemonic == ZYDIS_MNEMONIC_NOP || instruction.info.mnemonic == ZYDIS_MNEMONIC_JMP) {
-            uint64_t next_int = get_le32(m_executable.section_data(m_section.c_str()) + offset);
-            bool in_jump_table = false;
-
             // Naive jump table detection attempt uint32_t representation happens to be in function address space.
-            while (next_int >= m_startAddress && next_int <= m_endAddress) {
-                // If this is first entry of jump table, create label to jump to.
-                if (!in_jump_table) {
-                    if (runtime_address >= m_startAddress && runtime_address <= m_endAddress
-                        && m_labels.find(runtime_address) == m_labels.end()) {
-                        std::stringstream stream;
-                        stream << std::hex << runtime_address;
-                        m_labels[runtime_address] = std::string("loc_") + stream.str();
-                        m_executable.add_symbol(m_labels[runtime_address].c_str(), runtime_address);
-                    }
+            // The emit pass reuses the tables recorded here.
+            const uint32_t table_size = uint32_t(count_words_in_range(m_executable.section_data(m_section.c_str()) + offset,
+                m_executable.section_size(m_section.c_str()) - offset,
+                m_startAddress,
+                m_endAddress));
+
+            if (table_size != 0) {
+                const JumpTable table = {uint32_t(runtime_address - m_startAddress), table_size, false};
+                m_jumpTables.push_back(table);
+                offset += table_size * sizeof(uint32_t);
+                runtime_address += table_size * sizeof(uint32_t);
+            }
+        }
+    }
 
-                    in_jump_table = true;
-                }
+    build_cfg();
+    track_stack();
+    create_labels();
+}
 
-                if (m_labels.find(next_int) == m_labels.end()) {
-                    std::stringstream stream;
-                    stream << std::hex << next_int;
-                    m_labels[next_int] = std::string("loc_") + stream.str();
-                    m_executable.add_symbol(m_labels[next_int].c_str(), next_int);
-                }
+bool unassemblize::Function::seed(const std::vector<InstructionInfo> &instructions,
+    const std::vector<JumpTable> &jump_tables,
+    const std::vector<uint64_t> &labels)
+{
+    if (m_startAddress < section_address() || m_startAddress >= section_end()) {
+        return false;
+    }
 
-                offset += sizeof(uint32_t);
-                runtime_address += sizeof(uint32_t);
-                next_int = get_le32(m_executable.section_data(m_section.c_str()) + offset);
-            }
+    // Emitting reads the section at every recorded offset, so they have to be in order and inside it.
+    const uint64_t limit = section_end() - m_startAddress;
+    uint64_t next = 0;
+
+    for (auto it = instructions.begin(); it != instructions.end(); ++it) {
+        if (it->offset < next || it->length == 0 || uint64_t(it->offset) + it->length > limit) {
+            return false;
+        }
+
+        next = uint64_t(it->offset) + it->length;
+    }
+
+    for (auto it = jump_tables.begin(); it != jump_tables.end(); ++it) {
+        if (uint64_t(it->offset) + uint64_t(it->count) * sizeof(uint32_t) > limit) {
+            return false;
         }
     }
 
-    offset = m_startAddress - m_executable.section_address(m_section.c_str());
-    runtime_address = m_startAddress;
-    in_jump_table = false;
+    m_instructions = instructions;
+    m_jumpTables = jump_tables;
+    m_labels.clear();
+    m_labelBits.assign((m_endAddress - m_startAddress) / 64 + 1, 0);
+    m_analysed = true;
+
+    // Stack deltas and reachability are stored as the analysis left them, rebuilding the graph keeps them unchanged.
+    build_cfg();
+
+    for (auto it = labels.begin(); it != labels.end(); ++it) {
+        add_label(*it);
+    }
+
+    return true;
+}
+
+void unassemblize::Function::disassemble(AsmFormat fmt)
+{
+    if (m_executable.section_size(m_section.c_str()) == 0) {
+        return;
+    }
+
+    if (!m_analysed) {
+        analyse();
+    }
+
+    // Labels become symbols so operands referring to them are printed by name.
+    for (auto it = m_labels.begin(); it != m_labels.end(); ++it) {
+        m_executable.add_symbol(it->second.c_str(), it->first);
+    }
+
+    ZyanUSize offset = m_startAddress - m_executable.section_address(m_section.c_str());
+    uint64_t runtime_address = m_startAddress;
+    ZyanUSize end_offset = m_endAddress - m_executable.section_address(m_section.c_str());
+    ZydisDisassembledInstruction instruction;
+    m_unreachableBytes = 0;
+
+    const uint8_t *data = m_executable.section_data(m_section.c_str()) + (m_startAddress - section_address());
+    uint32_t covered = 0; // End of the bytes the first pass walked over.
+
+    if (!m_instructions.empty()) {
+        covered = m_instructions.back().offset + m_instructions.back().length;
+    }
+
+    if (!m_jumpTables.empty()) {
+        covered = std::max<uint32_t>(covered, m_jumpTables.back().offset + m_jumpTables.back().count * sizeof(uint32_t));
+    }
+
+    m_currentInstruction = 0;
+    auto table = m_jumpTables.begin();
     ZydisFormatterStyle style;
 
     switch (fmt) {
@@ -579,61 +891,383 @@ void unassemblize::Function::disassemble(AsmFormat fmt)
             break;
     }
 
-    while (ZYAN_SUCCESS(UnasmDisassembleCustom(ZYDIS_MACHINE_MODE_LEGACY_32,
-               runtime_address,
-               m_executable.section_data(m_section.c_str()) + offset,
-               96,
-               &instruction,
-               this,
-               style))
-        && offset <= end_offset) {
+    while (offset <= end_offset) {
+        const uint32_t position = uint32_t(runtime_address - m_startAddress);
+
+        if (table != m_jumpTables.end() && table->offset == position && table->reachable) {
+            const unassemblize::Executable::Symbol &label = m_executable.get_symbol(runtime_address);
+
+            if (!label.name.empty()) {
+                append_symbol(label.name);
+                m_dissassembly += ":\n";
+            }
+
+            for (uint32_t i = 0; i < table->count; ++i) {
+                const unassemblize::Executable::Symbol &symbol =
+                    m_executable.get_symbol(get_le32(data + position + i * sizeof(uint32_t)));
+
+                if (!symbol.name.empty()) {
+                    if (fmt == FORMAT_MASM) {
+                        m_dissassembly += "    DWORD ";
+                    } else {
+                        m_dissassembly += "    .int ";
+                    }
+                    append_symbol(symbol.name);
+                    m_dissassembly += "\n";
+                }
+            }
+
+            offset += table->count * sizeof(uint32_t);
+            runtime_address += table->count * sizeof(uint32_t);
+            ++table;
+            continue;
+        }
+
+        const bool at_instruction =
+            m_currentInstruction < m_instructions.size() && m_instructions[m_currentInstruction].offset == position;
+
+        if (position < covered && (!at_instruction || !m_instructions[m_currentInstruction].reachable)) {
+            // Bytes up to the next reachable instruction or jump table are data or padding, don't decode them.
+            uint32_t run_end = covered;
 
-        if (m_labels.find(runtime_address) != m_labels.end()) {
-            m_dissassembly += m_labels[runtime_address];
+            for (size_t i = m_currentInstruction; i < m_instructions.size(); ++i) {
+                if (m_instructions[i].reachable) {
+                    run_end = m_instructions[i].offset;
+                    break;
+                }
+            }
+
+            for (auto it = table; it != m_jumpTables.end() && it->offset < run_end; ++it) {
+                if (it->reachable) {
+                    run_end = it->offset;
+                    break;
+                }
+            }
+
+            emit_bytes(data + position, run_end - position, fmt);
+            m_unreachableBytes += run_end - position;
+            offset += run_end - position;
+            runtime_address += run_end - position;
+
+            while (m_currentInstruction < m_instructions.size() && m_instructions[m_currentInstruction].offset < run_end) {
+                ++m_currentInstruction;
+            }
+
+            while (table != m_jumpTables.end() && table->offset < run_end) {
+                ++table;
+            }
+
+            continue;
+        }
+
+        m_instructionSpans.clear();
+
+        if (!ZYAN_SUCCESS(UnasmDisassembleCustom(machine_mode(m_executable),
+                runtime_address,
+                m_executable.section_data(m_section.c_str()) + offset,
+                96,
+                &instruction,
+                this,
+                style))) {
+            break;
+        }
+
+        if (m_labelBits[position >> 6] & (uint64_t(1) << (position & 63))) {
+            append_symbol(m_labels.find(runtime_address)->second);
             m_dissassembly += ":\n";
         }
 
         m_dissassembly += "    ";
+
+        for (auto it = m_instructionSpans.begin(); it != m_instructionSpans.end(); ++it) {
+            m_symbolSpans.push_back({uint32_t(m_dissassembly.size()) + it->offset, it->length});
+        }
+
         m_dissassembly += instruction.text;
+
+        if (!m_comment.empty()) {
+            m_dissassembly += fmt == FORMAT_MASM ? " ; " : " # ";
+            m_dissassembly += m_comment;
+            m_comment.clear();
+        }
+
         m_dissassembly += '\n';
+        ++m_currentInstruction;
         offset += instruction.info.length;
         runtime_address += instruction.info.length;
+    }
+}
 
-        // If instruction is a nop or jmp, could be at an inline jump table.
-        if (instruction.info.mnemonic == ZYDIS_MNEMONIC_NOP || instruction.info.mnemonic == ZYDIS_MNEMONIC_JMP) {
-            uint64_t next_int = get_le32(m_executable.section_data(m_section.c_str()) + offset);
-            bool in_jump_table = false;
+void unassemblize::Function::create_labels()
+{
+    m_labelBits.assign((m_endAddress - m_startAddress) / 64 + 1, 0);
 
-            // Naive jump table detection attempt uint32_t representation happens to be in function address space.
-            while (next_int >= m_startAddress && next_int <= m_endAddress) {
-                // If this is first entry of jump table, create label to jump to.
+    // Only targets of reachable code get labels, garbage decoded from trailing data would otherwise add bogus ones.
+    for (auto it = m_instructions.begin(); it != m_instructions.end(); ++it) {
+        if (it->reachable && it->target != UINT32_MAX && it->flow != FLOW_SWITCH) {
+            add_label(m_startAddress + it->target);
+        }
+    }
 
-                if (!in_jump_table) {
-                    const unassemblize::Executable::Symbol &symbol = m_executable.get_symbol(runtime_address);
+    const uint8_t *data = m_executable.section_data(m_section.c_str()) + (m_startAddress - section_address());
 
-                    if (!symbol.name.empty()) {
-                        m_dissassembly += symbol.name;
-                        m_dissassembly += ":\n";
-                    }
+    for (auto it = m_jumpTables.begin(); it != m_jumpTables.end(); ++it) {
+        if (!it->reachable) {
+            continue;
+        }
+
+        add_label(m_startAddress + it->offset);
+
+        for (uint32_t i = 0; i < it->count; ++i) {
+            add_label(get_le32(data + it->offset + i * sizeof(uint32_t)));
+        }
+    }
+}
+
+void unassemblize::Function::add_label(uint64_t address)
+{
+    if (m_labels.find(address) == m_labels.end()) {
+        std::stringstream stream;
+        stream << std::hex << address;
+        m_labels[address] = std::string("loc_") + stream.str();
+    }
+
+    uint64_t position = address - m_startAddress;
+
+    if (position <= m_endAddress - m_startAddress) {
+        m_labelBits[position >> 6] |= uint64_t(1) << (position & 63);
+    }
+}
+
+void unassemblize::Function::append_symbol(const std::string &name)
+{
+    m_symbolSpans.push_back({uint32_t(m_dissassembly.size()), uint32_t(name.size())});
+    m_dissassembly += name;
+}
 
-                    in_jump_table = true;
+void unassemblize::Function::emit_bytes(const uint8_t *data, uint32_t size, AsmFormat fmt)
+{
+    char buffer[48];
+    bool uniform = size > 1;
+
+    for (uint32_t i = 1; i < size && uniform; ++i) {
+        uniform = data[i] == data[0];
+    }
+
+    // Runs of one value are almost always alignment padding.
+    if (uniform) {
+        if (fmt == FORMAT_MASM) {
+            snprintf(buffer, sizeof(buffer), "    DB %u DUP (0%02Xh)\n", size, data[0]);
+        } else {
+            snprintf(buffer, sizeof(buffer), "    .fill %u, 1, 0x%02x\n", size, data[0]);
+        }
+
+        m_dissassembly += buffer;
+        return;
+    }
+
+    for (uint32_t i = 0; i < size; ++i) {
+        if (i % 16 == 0) {
+            m_dissassembly += fmt == FORMAT_MASM ? "    DB " : "    .byte ";
+        }
+
+        snprintf(buffer, sizeof(buffer), fmt == FORMAT_MASM ? "0%02Xh" : "0x%02x", data[i]);
+        m_dissassembly += buffer;
+        m_dissassembly += i % 16 == 15 || i + 1 == size ? "\n" : ", ";
+    }
+}
+
+void unassemblize::Function::build_cfg()
+{
+    m_blocks.clear();
+    m_edges.clear();
+
+    if (m_instructions.empty()) {
+        return;
+    }
+
+    const uint8_t *data = m_executable.section_data(m_section.c_str()) + (m_startAddress - section_address());
+    const uint32_t size = m_instructions.back().offset + m_instructions.back().length;
+    std::vector<uint8_t> leaders(size, 0);
+    std::vector<uint32_t> block_at(size, UINT32_MAX);
+
+    // Blocks start at the entry, at every local branch or call target and after every instruction that ends a block.
+    leaders[0] = 1;
+
+    for (size_t i = 0; i < m_instructions.size(); ++i) {
+        const InstructionInfo &info = m_instructions[i];
+
+        if (info.flow == FLOW_NORMAL) {
+            continue;
+        }
+
+        if (info.flow != FLOW_SWITCH && info.target < size) {
+            leaders[info.target] = 1;
+        }
+
+        if (info.flow == FLOW_CALL) {
+            continue;
+        }
+
+        if (i + 1 < m_instructions.size()) {
+            leaders[m_instructions[i + 1].offset] = 1;
+        }
+    }
+
+    for (const JumpTable &table : m_jumpTables) {
+        for (uint32_t i = 0; i < table.count; ++i) {
+            uint64_t target = get_le32(data + table.offset + i * sizeof(uint32_t)) - m_startAddress;
+
+            if (target < size) {
+                leaders[target] = 1;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < m_instructions.size(); ++i) {
+        const InstructionInfo &info = m_instructions[i];
+
+        if (m_blocks.empty() || leaders[info.offset]) {
+            BasicBlock block = {i, 0, 0, 0};
+            block_at[info.offset] = uint32_t(m_blocks.size());
+            m_blocks.push_back(block);
+        }
+
+        ++m_blocks.back().instruction_count;
+    }
+
+    // Successors, a target landing inside an instruction has no block and gets no edge.
+    for (uint32_t i = 0; i < m_blocks.size(); ++i) {
+        BasicBlock &block = m_blocks[i];
+        const InstructionInfo &last = m_instructions[block.first_instruction + block.instruction_count - 1];
+        const uint32_t next = last.offset + last.length;
+        block.first_edge = uint32_t(m_edges.size());
+
+        switch (last.flow) {
+            case FLOW_NORMAL:
+            case FLOW_CALL:
+            case FLOW_BRANCH:
+                if (next < size && block_at[next] != UINT32_MAX) {
+                    m_edges.push_back(block_at[next]);
                 }
 
-                const unassemblize::Executable::Symbol &symbol = m_executable.get_symbol(next_int);
+                if (last.flow != FLOW_BRANCH) {
+                    break;
+                }
+                // Fall through to add the taken edge.
+            case FLOW_JUMP:
+                if (last.target < size && block_at[last.target] != UINT32_MAX) {
+                    m_edges.push_back(block_at[last.target]);
+                }
+                break;
+            case FLOW_SWITCH:
+                for (const JumpTable &table : m_jumpTables) {
+                    if (table.offset != last.target) {
+                        continue;
+                    }
 
-                if (!symbol.name.empty()) {
-                    if (fmt == FORMAT_MASM) {
-                        m_dissassembly += "    DWORD ";
-                    } else {
-                        m_dissassembly += "    .int ";
+                    for (uint32_t j = 0; j < table.count; ++j) {
+                        uint64_t target = get_le32(data + table.offset + j * sizeof(uint32_t)) - m_startAddress;
+
+                        if (target < size && block_at[target] != UINT32_MAX
+                            && std::find(m_edges.begin() + block.first_edge, m_edges.end(), block_at[target])
+                                == m_edges.end()) {
+                            m_edges.push_back(block_at[target]);
+                        }
                     }
-                    m_dissassembly += symbol.name;
-                    m_dissassembly += "\n";
                 }
+                break;
+            default:
+                break;
+        }
+
+        block.edge_count = uint32_t(m_edges.size()) - block.first_edge;
+    }
+
+    // Walk from the entry, local call targets count as reachable too. A switch whose table wasn't found could go
+    // anywhere, in that case everything is kept.
+    std::vector<uint8_t> visited(m_blocks.size(), 0);
+    std::vector<uint32_t> pending(1, 0);
+    bool unresolved = false;
+    visited[0] = 1;
+
+    while (!pending.empty()) {
+        const BasicBlock &block = m_blocks[pending.back()];
+        pending.pop_back();
+
+        for (uint32_t i = block.first_instruction; i < block.first_instruction + block.instruction_count; ++i) {
+            InstructionInfo &info = m_instructions[i];
+            info.reachable = 1;
+
+            if (info.flow == FLOW_CALL && info.target < size && block_at[info.target] != UINT32_MAX
+                && !visited[block_at[info.target]]) {
+                visited[block_at[info.target]] = 1;
+                pending.push_back(block_at[info.target]);
+            } else if (info.flow == FLOW_SWITCH
+                && std::none_of(m_jumpTables.begin(), m_jumpTables.end(), [&info](const JumpTable &table) {
+                       return table.offset == info.target;
+                   })) {
+                unresolved = true;
+            }
+        }
+
+        for (uint32_t i = block.first_edge; i < block.first_edge + block.edge_count; ++i) {
+            if (!visited[m_edges[i]]) {
+                visited[m_edges[i]] = 1;
+                pending.push_back(m_edges[i]);
+            }
+        }
+    }
+
+    for (auto it = m_instructions.begin(); it != m_instructions.end(); ++it) {
+        it->reachable |= unresolved;
+    }
+
+    for (auto it = m_jumpTables.begin(); it != m_jumpTables.end(); ++it) {
+        const uint32_t offset = it->offset;
+        auto next = std::lower_bound(m_instructions.begin(),
+            m_instructions.end(),
+            offset,
+            [](const InstructionInfo &info, uint32_t value) { return info.offset < value; });
+
+        it->reachable = unresolved || (next != m_instructions.begin() && (next - 1)->reachable)
+            || std::any_of(m_instructions.begin(), m_instructions.end(), [offset](const InstructionInfo &info) {
+                   return info.reachable && info.flow == FLOW_SWITCH && info.target == offset;
+               });
+    }
+}
+
+void unassemblize::Function::track_stack()
+{
+    // The label pass stored each instruction's own effect in the stack field, turn that into the running delta. Blocks
+    // are visited once in address order and take the delta of the first visited predecessor, so blocks only reached
+    // through back edges stay unknown.
+    std::vector<int32_t> entry(m_blocks.size(), STACK_UNKNOWN);
+
+    if (!m_blocks.empty()) {
+        entry[0] = 0;
+    }
+
+    for (size_t i = 0; i < m_blocks.size(); ++i) {
+        const BasicBlock &block = m_blocks[i];
+        int32_t delta = entry[i];
+
+        for (uint32_t j = block.first_instruction; j < block.first_instruction + block.instruction_count; ++j) {
+            const int32_t effect = m_instructions[j].stack;
+            m_instructions[j].stack = delta;
+
+            if (delta != STACK_UNKNOWN) {
+                delta = effect == STACK_UNKNOWN ? STACK_UNKNOWN : delta + effect;
+            }
+        }
+
+        if (delta == STACK_UNKNOWN) {
+            continue;
+        }
 
-                offset += sizeof(uint32_t);
-                runtime_address += sizeof(uint32_t);
-                next_int = get_le32(m_executable.section_data(m_section.c_str()) + offset);
+        for (uint32_t j = block.first_edge; j < block.first_edge + block.edge_count; ++j) {
+            if (entry[m_edges[j]] == STACK_UNKNOWN) {
+                entry[m_edges[j]] = delta;
             }
         }
     }
@@ -31,15 +31,124 @@ public:
         FORMAT_MASM,
     };
 
+    enum FlowTypes
+    {
+        FLOW_NORMAL, // Falls through to the next instruction.
+        FLOW_CALL,
+        FLOW_BRANCH, // Conditional branch, falls through when not taken.
+        FLOW_JUMP, // Unconditional jump, direct or indirect.
+        FLOW_SWITCH, // Indirect jump through a register or an indexed table.
+        FLOW_RETURN, // Return or trap, no successors.
+    };
+
+    enum : int32_t
+    {
+        STACK_UNKNOWN = INT32_MIN, // ESP delta could not be tracked.
+    };
+
+    /**
+     * Decoded instruction recorded by the label pass, target is relative to the function start and is UINT32_MAX when
+     * the instruction has no target inside the function. For FLOW_SWITCH it is the offset of the jump table or
+     * UINT32_MAX if the table isn't known.
+     */
+    struct InstructionInfo
+    {
+        uint32_t offset;
+        uint32_t target;
+        int32_t stack; // ESP relative to the function entry before this instruction executes, or STACK_UNKNOWN.
+        uint8_t length;
+        uint8_t flow;
+        uint8_t reachable; // Non zero if reachable from the function entry.
+    };
+
+    struct JumpTable
+    {
+        uint32_t offset; // Offset of the table from the function start.
+        uint32_t count; // Number of 32 bit entries.
+        bool reachable; // Used by reachable code or directly following it.
+    };
+
+    /**
+     * Basic block covering a run of instructions, successors are block IDs in edges()[first_edge, first_edge + edge_count).
+     */
+    struct BasicBlock
+    {
+        uint32_t first_instruction;
+        uint32_t instruction_count;
+        uint32_t first_edge;
+        uint32_t edge_count;
+    };
+
+    struct SymbolSpan
+    {
+        uint32_t offset; // Position of the symbol name in dissassembly().
+        uint32_t length;
+    };
+
+    struct OperandSymbol
+    {
+        uint64_t address; // Instruction the operand belongs to.
+        uint64_t addend; // Printed after the name as +0x.
+        uint8_t operand; // Index of the operand in the decoded instruction.
+        std::string name;
+    };
+
 public:
     Function(Executable &exe, const char *section_name, uint64_t start, uint64_t end) :
         m_section(section_name), m_startAddress(start), m_endAddress(end), m_executable(exe)
     {
     }
-    void disassemble(AsmFormat fmt = FORMAT_DEFAULT); // Run the dissassmbly of the function.
+    /**
+     * Decodes the function once to record its instruction stream, jump tables, control flow graph and labels.
+     * Doesn't modify the executable, so separate functions can be analysed in parallel.
+     */
+    void analyse();
+    /**
+     * Installs the instruction stream, jump tables and labels a saved analysis recorded for this range instead of
+     * decoding it again, only the control flow graph is rebuilt. Returns false without changing anything if the records
+     * don't fit inside the section.
+     */
+    bool seed(const std::vector<InstructionInfo> &instructions,
+        const std::vector<JumpTable> &jump_tables,
+        const std::vector<uint64_t> &labels);
+    void disassemble(AsmFormat fmt = FORMAT_DEFAULT); // Run the dissassmbly of the function, analysing it if needed.
     const std::string &dissassembly() const { return m_dissassembly; }
     const std::vector<std::string> &dependencies() const { return m_deps; }
     void add_dependency(const std::string &dep) { return m_deps.push_back(dep); }
+    /**
+     * Every symbol name written to dissassembly(), in order.
+     */
+    const std::vector<SymbolSpan> &symbol_spans() const { return m_symbolSpans; }
+    /**
+     * Records a symbol name at offset in the text of the instruction currently being formatted.
+     */
+    void add_symbol_span(uint32_t offset, uint32_t length) { m_instructionSpans.push_back({offset, length}); }
+    /**
+     * The symbol every operand printed by name stands for, in order.
+     */
+    const std::vector<OperandSymbol> &operand_symbols() const { return m_operandSymbols; }
+    void add_operand_symbol(uint64_t address, uint8_t operand, const char *name, uint64_t addend)
+    {
+        m_operandSymbols.push_back({address, addend, operand, name});
+    }
+    /**
+     * Adds a comment to the end of the line of the instruction currently being formatted.
+     */
+    void add_comment(const std::string &comment)
+    {
+        if (!m_comment.empty()) {
+            m_comment += ", ";
+        }
+
+        m_comment += comment;
+    }
+    /**
+     * ESP delta of the instruction currently being formatted, used to name stack slots.
+     */
+    int32_t stack_delta() const
+    {
+        return m_currentInstruction < m_instructions.size() ? m_instructions[m_currentInstruction].stack : STACK_UNKNOWN;
+    }
     uint64_t start_address() const { return m_startAddress; }
     uint64_t end_address() const { return m_endAddress; }
     uint64_t section_address() const { return m_executable.section_address(m_section.c_str()); }
@@ -49,11 +158,39 @@ public:
     }
     const std::map<uint64_t, std::string> &labels() const { return m_labels; }
     const Executable &executable() const { return m_executable; }
+    const std::vector<InstructionInfo> &instructions() const { return m_instructions; }
+    const std::vector<JumpTable> &jump_tables() const { return m_jumpTables; }
+    const std::vector<BasicBlock> &blocks() const { return m_blocks; }
+    const std::vector<uint32_t> &edges() const { return m_edges; }
+    /**
+     * Bytes inside the range not reachable from the entry, emitted as data instead of instructions.
+     */
+    uint32_t unreachable_bytes() const { return m_unreachableBytes; }
+
+private:
+    void build_cfg();
+    void track_stack();
+    void create_labels();
+    void add_label(uint64_t address);
+    void emit_bytes(const uint8_t *data, uint32_t size, AsmFormat fmt);
+    void append_symbol(const std::string &name);
 
 private:
     std::map<uint64_t, std::string> m_labels; // Map of labels this function uses internally.
+    std::vector<uint64_t> m_labelBits; // One bit per byte of the function, set where a label starts.
     std::vector<std::string> m_deps; // Symbols this function depends on.
     std::string m_dissassembly; // Dissassembly buffer for this function.
+    std::string m_comment; // Pending comment for the current instruction.
+    std::vector<SymbolSpan> m_symbolSpans;
+    std::vector<SymbolSpan> m_instructionSpans; // Spans within the instruction currently being formatted.
+    std::vector<OperandSymbol> m_operandSymbols;
+    std::vector<InstructionInfo> m_instructions; // Instruction stream found by the label pass.
+    std::vector<JumpTable> m_jumpTables; // Inline jump tables found by the label pass.
+    std::vector<BasicBlock> m_blocks; // Control flow graph blocks, block 0 is the entry.
+    std::vector<uint32_t> m_edges; // Successor block IDs of all blocks.
+    size_t m_currentInstruction = 0; // Index into m_instructions while emitting.
+    uint32_t m_unreachableBytes = 0;
+    bool m_analysed = false;
     const std::string m_section;
     const uint64_t m_startAddress; // Runtime start address of the function.
     const uint64_t m_endAddress; // Runtime end address of the function.
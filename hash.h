@@ -0,0 +1,37 @@
+/**
+ * @file
+ *
+ * @brief Non cryptographic hashing helpers.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace unassemblize
+{
+const uint64_t FNV1A_64_OFFSET = 0xcbf29ce484222325ULL;
+const uint64_t FNV1A_64_PRIME = 0x100000001b3ULL;
+
+/**
+ * 64 bit FNV-1a, pass a previous result as hash to continue hashing more data.
+ */
+inline uint64_t fnv1a_64(const void *data, size_t size, uint64_t hash = FNV1A_64_OFFSET)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= FNV1A_64_PRIME;
+    }
+
+    return hash;
+}
+} // namespace unassemblize
@@ -10,9 +10,16 @@
  *            A full copy of the GNU General Public License can be found in
  *            LICENSE
  */
+#include "analysisdb.h"
+#include "codeindex.h"
+#include "compare.h"
 #include "function.h"
 #include "gitinfo.h"
+#include "query.h"
+#include "symbolspans.h"
+#include "verify.h"
 #include <LIEF/LIEF.hpp>
+#include <filesystem>
 #include <getopt.h>
 #include <inttypes.h>
 #include <stdio.h>
@@ -38,20 +45,263 @@ void print_help()
         "  -c --config     Configuration file describing how to dissassemble the input\n"
         "                  file and containing extra symbol info. Default: config.json\n"
         "  -s --start      Starting address of a single function to dissassemble in\n"
-        "                  hexidecimal notation.\n"
+        "                  hexidecimal notation. Dissassembles every known function\n"
+        "                  in the section if neither start nor end are given.\n"
         "  -e --end        Ending address of a single function to dissassemble in\n"
-        "                  hexidecimal notation.\n"
+        "                  hexidecimal notation. Taken from the function table if\n"
+        "                  omitted.\n"
         "  -v --verbose    Verbose output on current state of the program.\n"
         "  --section       Section to target for dissassembly, defaults to '.text'.\n"
         "  --listsections  Prints a list of sections in the exe then exits.\n"
         "  -d --dumpsyms   Dumps symbols stored in the executable to the config file.\n"
         "                  then exits.\n"
+        "  --findstring    Lists strings containing the given text and the functions\n"
+        "                  referencing them then exits.\n"
+        "  --findconst     Lists every instruction using the given constant as an\n"
+        "                  immediate or displacement then exits.\n"
+        "  --query         Lists every match of an instruction sequence query such as\n"
+        "                  \"mov ecx, [esp+?]; call ?; test eax, eax\" then exits.\n"
+        "  --metrics       Writes size, block count, call count, complexity and\n"
+        "                  unresolved reference count of each dissassembled function\n"
+        "                  to the given file, as JSON for .json files and CSV otherwise.\n"
+        "  --db            Analysis database to load the function table, labels,\n"
+        "                  references, constants and the --query index from. Rebuilt\n"
+        "                  when missing or when it was made for a different input\n"
+        "                  file. Functions are still analysed again when they are\n"
+        "                  dissassembled.\n"
+        "  --compare       Compares functions with those of the same name in the given\n"
+        "                  recompiled executable and lists the ones that differ.\n"
+        "  --comparecache  Cache file for --compare results, only pairs whose bytes\n"
+        "                  changed since the cached run are compared again.\n"
+        "  --verify        Re-encodes every instruction and lists the first one in each\n"
+        "                  function that doesn't reproduce the original bytes then exits.\n"
+        "  --verifyas      Writes the section as shards to the given directory, assembles\n"
+        "                  them with GNU as in parallel and lists functions whose bytes\n"
+        "                  differ from the original then exits.\n"
+        "  --outdir        Writes every function of the section to its own file under\n"
+        "                  the given directory as <object>/<symbol>.S with a manifest.json\n"
+        "                  listing them instead of writing a single output file.\n"
+        "  --deps          Writes a make depfile for the output listing the executable,\n"
+        "                  the config file if there is one and the analysis database.\n"
+        "                  With --outdir it writes <object>.syms, a stamp of what the\n"
+        "                  object's files are made from, and <object>.d for it instead.\n"
+        "                  Objects whose stamp didn't change aren't formatted again and\n"
+        "                  files whose text didn't change keep their time.\n"
+        "  --index         Writes output.idx alongside the output file, giving the name,\n"
+        "                  address, byte offset and length of every function in it.\n"
+        "  --spans         Records where every symbol name is written in a side table,\n"
+        "                  output.spans or symbols.spans in the output directory.\n"
+        "  --rename        Takes an old and a new symbol name and replaces the old one\n"
+        "                  in the existing output using its span table then exits.\n"
+        "  --fold          Emits functions whose normalized bodies and references match\n"
+        "                  an earlier one as an alias of it instead of a second copy.\n"
+        "                  Ignored with --outdir, where the alias and its body would end\n"
+        "                  up in different objects.\n"
         "  -h --help       Displays this help.\n\n",
         revision,
         GitUncommittedChanges ? "~" : "",
         version);
 }
 
+const char *function_name(unassemblize::Executable &exe, uint64_t address, char *buffer, size_t size)
+{
+    const std::string &name = exe.get_symbol(address).name;
+
+    if (!name.empty()) {
+        return name.c_str();
+    }
+
+    snprintf(buffer, size, "sub_%" PRIx64, address);
+
+    return buffer;
+}
+
+void print_string_references(unassemblize::Executable &exe, const unassemblize::AnalysisDatabase *db, const char *text)
+{
+    const unassemblize::StringIndex &strings = exe.strings();
+    std::vector<size_t> results;
+    strings.search(text, results);
+
+    if (results.empty()) {
+        printf("No strings containing '%s' found.\n", text);
+        return;
+    }
+
+    unassemblize::CodeIndex code;
+
+    if (db != nullptr) {
+        code.load(exe, *db);
+    } else {
+        code.build(exe);
+    }
+
+    for (auto it = results.begin(); it != results.end(); ++it) {
+        const unassemblize::StringIndex::Entry &entry = strings.entries()[*it];
+        auto refs = code.references_to(entry.address);
+        printf("0x%" PRIx64 " %s\"%s\"\n", entry.address, entry.wide ? "L" : "", strings.text(entry).c_str());
+
+        for (auto ref = refs.first; ref != refs.second; ++ref) {
+            char buffer[32];
+            printf("    %s (0x%" PRIx64 ")\n", function_name(exe, ref->function, buffer, sizeof(buffer)), ref->address);
+        }
+    }
+}
+
+void print_constant_uses(
+    unassemblize::Executable &exe, const unassemblize::AnalysisDatabase *db, const char *value_string)
+{
+    uint64_t value = strtoull(value_string, nullptr, 0);
+
+    // Negative values are entered in their signed form, match how they are stored for 32 bit code.
+    if (value_string[0] == '-') {
+        value = strtoll(value_string, nullptr, 0);
+    }
+
+    if (exe.pointer_size() == sizeof(uint32_t)) {
+        value &= UINT32_MAX;
+    }
+
+    unassemblize::CodeIndex code;
+
+    if (db != nullptr) {
+        code.load(exe, *db);
+    } else {
+        code.build(exe);
+    }
+
+    auto uses = code.uses_of(value);
+
+    if (uses.first == uses.second) {
+        printf("No uses of 0x%" PRIx64 " found.\n", value);
+        return;
+    }
+
+    for (auto use = uses.first; use != uses.second; ++use) {
+        char buffer[32];
+        printf("0x%" PRIx64 " in %s\n", use->address, function_name(exe, use->function, buffer, sizeof(buffer)));
+    }
+}
+
+void print_query_matches(
+    unassemblize::Executable &exe, const unassemblize::AnalysisDatabase *db, const char *query_string)
+{
+    unassemblize::InstructionQuery query;
+    std::string error;
+
+    if (!query.parse(query_string, error)) {
+        printf("Invalid query: %s.\n", error.c_str());
+        return;
+    }
+
+    unassemblize::CodeIndex code;
+
+    if (db != nullptr) {
+        code.load(exe, *db);
+    } else {
+        code.build(exe);
+    }
+
+    std::vector<uint32_t> matches;
+    query.run(code, matches);
+
+    for (auto it = matches.begin(); it != matches.end(); ++it) {
+        char buffer[32];
+        uint64_t address = code.instructions()[*it].address;
+        const unassemblize::Executable::FunctionEntry *func = exe.find_function(address);
+        printf("0x%" PRIx64 " in %s\n",
+            address,
+            func != nullptr ? function_name(exe, func->start, buffer, sizeof(buffer)) : "?");
+    }
+
+    printf("%zu matches.\n", matches.size());
+}
+
+void print_comparison(unassemblize::Executable &exe, const char *file_name, const char *cache_file, bool verbose)
+{
+    unassemblize::Executable recompiled(file_name, unassemblize::Executable::OUTPUT_IGAS, verbose);
+    recompiled.discover_functions();
+
+    unassemblize::Comparison comparison;
+
+    if (cache_file != nullptr) {
+        comparison.load_cache(cache_file);
+    }
+
+    comparison.run(exe, recompiled);
+
+    if (cache_file != nullptr) {
+        comparison.save_cache(cache_file);
+
+        if (verbose) {
+            printf("%zu results taken from the cache.\n", comparison.cache_hits());
+        }
+    }
+    size_t counts[3] = {0};
+
+    for (auto it = comparison.results().begin(); it != comparison.results().end(); ++it) {
+        const std::string &name = exe.get_symbol(it->original).name;
+        ++counts[it->match];
+
+        if (it->match == unassemblize::Comparison::MATCH_MISSING) {
+            printf("%s: missing\n", name.c_str());
+        } else if (it->match == unassemblize::Comparison::MATCH_DIFFERENT) {
+            printf("%s: %.1f%% similar\n", name.c_str(), it->similarity * 100.0f);
+        }
+    }
+
+    printf("%zu identical, %zu different, %zu missing.\n", counts[0], counts[1], counts[2]);
+}
+
+void print_bytes(const uint8_t *bytes, size_t length)
+{
+    for (size_t i = 0; i < length; ++i) {
+        printf(i == 0 ? "%02x" : " %02x", bytes[i]);
+    }
+}
+
+void print_encoding_mismatches(unassemblize::Executable &exe)
+{
+    std::vector<unassemblize::EncodingMismatch> mismatches;
+    unassemblize::verify_encoding(exe, mismatches);
+
+    for (auto it = mismatches.begin(); it != mismatches.end(); ++it) {
+        char buffer[32];
+        printf("%s: 0x%" PRIx64 " ", function_name(exe, it->function, buffer, sizeof(buffer)), it->address);
+        print_bytes(it->original, it->original_length);
+
+        if (it->encoded_length == 0) {
+            printf(" can't be encoded\n");
+        } else {
+            printf(" encodes as ");
+            print_bytes(it->encoded, it->encoded_length);
+            printf("\n");
+        }
+    }
+
+    printf("%zu of %zu functions re-encode to their original bytes.\n",
+        exe.functions().size() - mismatches.size(),
+        exe.functions().size());
+}
+
+void print_assembly_mismatches(unassemblize::Executable &exe, const char *section_name, const char *directory)
+{
+    std::vector<unassemblize::AssemblyMismatch> mismatches;
+    unassemblize::verify_assembly(exe, section_name, directory, mismatches);
+
+    for (auto it = mismatches.begin(); it != mismatches.end(); ++it) {
+        char buffer[32];
+        const char *name = function_name(exe, it->function, buffer, sizeof(buffer));
+
+        if (it->offset == UINT64_MAX) {
+            printf("%s: shard failed to assemble, see the .log files in '%s'\n", name, directory);
+        } else {
+            printf("%s: first difference at +0x%" PRIx64 "\n", name, it->offset);
+        }
+    }
+
+    printf("%zu functions differ after assembly.\n", mismatches.size());
+}
+
 void print_sections(unassemblize::Executable &exe)
 {
     for (auto it = exe.sections().begin(); it != exe.sections().end(); ++it) {
@@ -71,11 +321,27 @@ int main(int argc, char **argv)
     const char *output = "program.S";
     const char *config_file = "config.json";
     const char *format_string = nullptr;
+    const char *find_string = nullptr;
+    const char *find_const = nullptr;
+    const char *query = nullptr;
+    const char *metrics_file = nullptr;
+    const char *db_file = nullptr;
+    const char *compare_file = nullptr;
+    const char *compare_cache = nullptr;
     uint64_t start_addr = 0;
     uint64_t end_addr = 0;
     bool print_secs = false;
     bool dump_syms = false;
     bool verbose = false;
+    bool verify = false;
+    bool fold = false;
+    const char *out_directory = nullptr;
+    bool write_deps = false;
+    bool write_index = false;
+    bool write_spans = false;
+    const char *rename_old = nullptr;
+    const char *rename_new = nullptr;
+    const char *verify_directory = nullptr;
 
     while (true) {
         static struct option long_options[] = {
@@ -86,6 +352,21 @@ int main(int argc, char **argv)
             {"config", required_argument, nullptr, 'c'},
             {"section", required_argument, nullptr, 1},
             {"listsections", no_argument, nullptr, 2},
+            {"findstring", required_argument, nullptr, 3},
+            {"findconst", required_argument, nullptr, 4},
+            {"query", required_argument, nullptr, 5},
+            {"metrics", required_argument, nullptr, 6},
+            {"db", required_argument, nullptr, 7},
+            {"compare", required_argument, nullptr, 8},
+            {"comparecache", required_argument, nullptr, 9},
+            {"verify", no_argument, nullptr, 10},
+            {"verifyas", required_argument, nullptr, 11},
+            {"fold", no_argument, nullptr, 12},
+            {"outdir", required_argument, nullptr, 13},
+            {"deps", no_argument, nullptr, 14},
+            {"index", no_argument, nullptr, 15},
+            {"spans", no_argument, nullptr, 16},
+            {"rename", required_argument, nullptr, 17},
             {"dumpsyms", no_argument, nullptr, 'd'},
             {"verbose", no_argument, nullptr, 'v'},
             {"help", no_argument, nullptr, 'h'},
@@ -107,6 +388,53 @@ int main(int argc, char **argv)
             case 2:
                 print_secs = true;
                 break;
+            case 3:
+                find_string = optarg;
+                break;
+            case 4:
+                find_const = optarg;
+                break;
+            case 5:
+                query = optarg;
+                break;
+            case 6:
+                metrics_file = optarg;
+                break;
+            case 7:
+                db_file = optarg;
+                break;
+            case 8:
+                compare_file = optarg;
+                break;
+            case 9:
+                compare_cache = optarg;
+                break;
+            case 10:
+                verify = true;
+                break;
+            case 11:
+                verify_directory = optarg;
+                break;
+            case 12:
+                fold = true;
+                break;
+            case 13:
+                out_directory = optarg;
+                break;
+            case 14:
+                write_deps = true;
+                break;
+            case 15:
+                write_index = true;
+                break;
+            case 16:
+                write_spans = true;
+                break;
+            case 17:
+                // The new name is the argument after the option's own.
+                rename_old = optarg;
+                rename_new = optind < argc ? argv[optind++] : nullptr;
+                break;
             case 'd':
                 dump_syms = true;
                 break;
@@ -144,6 +472,22 @@ int main(int argc, char **argv)
         }
     }
 
+    if (rename_old != nullptr) {
+        // Only the existing output and its span table are touched, the executable isn't needed.
+        std::string table = out_directory != nullptr ? std::string(out_directory) + "/symbols.spans"
+                                                     : std::string(output) + ".spans";
+        int64_t count =
+            rename_new != nullptr ? unassemblize::SymbolSpans::rename(table.c_str(), rename_old, rename_new) : -1;
+
+        if (count < 0) {
+            printf("Failed to rename '%s' using '%s'.\n", rename_old, table.c_str());
+            return 1;
+        }
+
+        printf("Renamed %" PRId64 " occurrences of '%s' to '%s'.\n", count, rename_old, rename_new);
+        return 0;
+    }
+
     if (verbose) {
         printf("Parsing executable file '%s'...\n", argv[optind]);
     }
@@ -173,13 +517,156 @@ int main(int argc, char **argv)
 
     exe.load_config(config_file);
 
+    unassemblize::AnalysisDatabase db;
+    bool have_db = false;
+
+    if (db_file != nullptr) {
+        uint64_t binary_hash = unassemblize::AnalysisDatabase::hash_file(argv[optind]);
+        uint64_t config_hash = unassemblize::AnalysisDatabase::hash_file(config_file);
+        have_db = db.load(db_file, binary_hash, config_hash);
+
+        if (have_db) {
+            if (verbose) {
+                printf("Using analysis database '%s'...\n", db_file);
+            }
+
+            db.apply(exe);
+        } else {
+            if (verbose) {
+                printf("Building analysis database '%s'...\n", db_file);
+            }
+
+            exe.discover_functions();
+            db.build(exe, binary_hash, config_hash);
+            db.apply(exe);
+            have_db = true;
+
+            if (!db.save(db_file)) {
+                printf("Failed to write analysis database '%s'.\n", db_file);
+            }
+        }
+    } else {
+        exe.discover_functions();
+    }
+
+    exe.index_strings(find_string != nullptr);
+
+    if (find_string != nullptr) {
+        print_string_references(exe, have_db ? &db : nullptr, find_string);
+        return 0;
+    }
+
+    if (find_const != nullptr) {
+        print_constant_uses(exe, have_db ? &db : nullptr, find_const);
+        return 0;
+    }
+
+    if (query != nullptr) {
+        print_query_matches(exe, have_db ? &db : nullptr, query);
+        return 0;
+    }
+
+    if (verify) {
+        print_encoding_mismatches(exe);
+        return 0;
+    }
+
+    if (verify_directory != nullptr) {
+        print_assembly_mismatches(exe, section_name, verify_directory);
+        return 0;
+    }
+
+    if (compare_file != nullptr) {
+        print_comparison(exe, compare_file, compare_cache, verbose);
+        return 0;
+    }
+
     FILE *fp = nullptr;
-    if (output != nullptr) {
-        fp = fopen(output, "w+");
+    FILE *index = nullptr;
+    if (output != nullptr && out_directory == nullptr) {
+        // Binary mode keeps the offsets in the index equal to byte positions on every platform.
+        fp = fopen(output, "w+b");
+        fprintf(fp, ".intel_syntax noprefix\n\n");
+
+        if (write_index && start_addr == 0 && end_addr == 0) {
+            index = fopen((std::string(output) + ".idx").c_str(), "w");
+
+            if (index == nullptr) {
+                printf("Failed to open '%s.idx' for writing.\n", output);
+                return 1;
+            }
+        }
     }
 
-    fprintf(fp, ".intel_syntax noprefix\n\n");
-    exe.dissassemble_function(fp, section_name, start_addr, end_addr);
+    unassemblize::SymbolSpans spans;
+    unassemblize::SymbolSpans *record_spans = write_spans && start_addr == 0 && end_addr == 0 ? &spans : nullptr;
+
+    if (out_directory != nullptr) {
+        // Skipped objects would be missing from the metrics.
+        bool incremental = write_deps && metrics_file == nullptr;
+
+        if (!exe.dissassemble_to_directory(out_directory, section_name, record_spans, incremental)) {
+            printf("Failed to write functions to '%s'.\n", out_directory);
+            return 1;
+        }
+    } else if (start_addr == 0 && end_addr == 0) {
+        // The table sits next to the output, so the file is named relative to it.
+        spans.add_file(std::filesystem::path(output).filename().string());
+        exe.dissassemble_functions(fp, section_name, fold, index, record_spans);
+    } else {
+        // Infer the end of the function from the function table if we can.
+        if (end_addr == 0) {
+            const unassemblize::Executable::FunctionEntry *func = exe.find_function(start_addr);
+
+            if (func != nullptr && func->start == start_addr) {
+                end_addr = func->end - 1;
+            }
+        }
+
+        exe.dissassemble_function(fp, section_name, start_addr, end_addr);
+    }
+
+    if (record_spans != nullptr) {
+        std::string table = out_directory != nullptr ? std::string(out_directory) + "/symbols.spans"
+                                                     : std::string(output) + ".spans";
+
+        if (!spans.save(table.c_str())) {
+            printf("Failed to write symbol spans to '%s'.\n", table.c_str());
+            return 1;
+        }
+    }
+
+    if (index != nullptr && fclose(index) != 0) {
+        printf("Failed to write the index for '%s'.\n", output);
+        return 1;
+    }
+
+    if (write_deps) {
+        std::vector<std::string> inputs(1, argv[optind]);
+        std::error_code error;
+
+        // A missing config is optional, listing it would make make look for a rule to create it.
+        if (std::filesystem::exists(config_file, error)) {
+            inputs.push_back(config_file);
+        }
+
+        if (db_file != nullptr) {
+            inputs.push_back(db_file);
+        }
+
+        bool written = out_directory != nullptr ? exe.write_dependencies(out_directory, nullptr, inputs)
+                                                : exe.write_dependencies(nullptr, output, inputs);
+
+        if (!written) {
+            printf("Failed to write dependency files.\n");
+            return 1;
+        }
+    }
+
+    if (metrics_file != nullptr && !exe.save_metrics(metrics_file)) {
+        printf("Failed to write metrics to '%s'.\n", metrics_file);
+        return 1;
+    }
 
     return 0;
 }
@@ -0,0 +1,142 @@
+/**
+ * @file
+ *
+ * @brief Layout independent views of function bytes.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#include "normalize.h"
+#include "executable.h"
+#include "hash.h"
+#include "scan.h"
+#include <Zydis/Zydis.h>
+#include <string.h>
+
+namespace
+{
+void clear_field(std::vector<uint8_t> &bytes, std::vector<uint8_t> &mask, uint64_t offset, uint64_t size)
+{
+    if (offset + size > bytes.size()) {
+        size = offset < bytes.size() ? bytes.size() - offset : 0;
+    }
+
+    memset(bytes.data() + offset, 0, size);
+    memset(mask.data() + offset, 0, size);
+}
+} // namespace
+
+void unassemblize::normalize_function(const Executable &exe,
+    uint64_t start,
+    uint64_t end,
+    std::vector<uint8_t> &bytes,
+    std::vector<uint8_t> &mask,
+    std::vector<uint64_t> *targets)
+{
+    bytes.clear();
+    mask.clear();
+
+    if (targets != nullptr) {
+        targets->clear();
+    }
+
+    const Executable::SectionInfo *section = exe.find_section(start);
+
+    if (section == nullptr || end <= start || end > section->address + section->size) {
+        return;
+    }
+
+    const bool is_64 = exe.pointer_size() == sizeof(uint64_t);
+    const uint64_t image_low = exe.base_address();
+    const uint64_t image_high = exe.end_address();
+    const uint8_t *data = section->data + (start - section->address);
+    const uint64_t size = end - start;
+    bytes.assign(data, data + size);
+    mask.assign(size, 0xFF);
+
+    ZydisDecoder decoder;
+    ZydisDecodedInstruction instruction;
+    ZydisDecoderInit(&decoder,
+        is_64 ? ZYDIS_MACHINE_MODE_LONG_64 : ZYDIS_MACHINE_MODE_LEGACY_32,
+        is_64 ? ZYDIS_STACK_WIDTH_64 : ZYDIS_STACK_WIDTH_32);
+
+    // Targets inside the function are recorded relative to its start and tagged so they can't match an address.
+    auto record = [&](uint64_t target) {
+        if (targets != nullptr) {
+            targets->push_back(target >= start && target < end ? (target - start) | (uint64_t(1) << 63) : target);
+        }
+    };
+
+    for (uint64_t offset = 0; offset < size;) {
+        if (ZYAN_FAILED(ZydisDecoderDecodeInstruction(&decoder, nullptr, data + offset, size - offset, &instruction))) {
+            ++offset;
+            continue;
+        }
+
+        for (unsigned i = 0; i < 2; ++i) {
+            const ZydisImmInfo &imm = instruction.raw.imm[i];
+            const uint64_t value = imm.value.u;
+
+            if (imm.size == 0) {
+                continue;
+            }
+
+            if (imm.is_relative) {
+                uint64_t target = start + offset + instruction.length + uint64_t(imm.value.s);
+                record(is_64 ? target : uint32_t(target));
+                clear_field(bytes, mask, offset + imm.offset, imm.size / 8);
+            } else if (imm.size >= 32 && value >= image_low && value < image_high) {
+                record(value);
+                clear_field(bytes, mask, offset + imm.offset, imm.size / 8);
+            }
+        }
+
+        const uint64_t disp = uint64_t(instruction.raw.disp.value);
+
+        // Mod 0 with r/m 5 addresses relative to the next instruction in 64 bit mode instead of absolutely.
+        if (is_64 && (instruction.attributes & ZYDIS_ATTRIB_HAS_MODRM) != 0 && instruction.raw.modrm.mod == 0
+            && instruction.raw.modrm.rm == 5) {
+            record(start + offset + instruction.length + disp);
+            clear_field(bytes, mask, offset + instruction.raw.disp.offset, instruction.raw.disp.size / 8);
+        } else if (instruction.raw.disp.size >= 32 && disp >= image_low && disp < image_high) {
+            record(disp);
+            clear_field(bytes, mask, offset + instruction.raw.disp.offset, instruction.raw.disp.size / 8);
+        }
+
+        offset += instruction.length;
+
+        // Inline jump table entries are absolute addresses as well.
+        if (instruction.mnemonic == ZYDIS_MNEMONIC_NOP || instruction.mnemonic == ZYDIS_MNEMONIC_JMP) {
+            uint64_t count = count_words_in_range(data + offset, size - offset, start, end - 1);
+
+            for (uint64_t i = 0; i < count; ++i) {
+                uint32_t word;
+                memcpy(&word, data + offset + i * sizeof(uint32_t), sizeof(word));
+                record(word);
+            }
+
+            clear_field(bytes, mask, offset, count * sizeof(uint32_t));
+            offset += count * sizeof(uint32_t);
+        }
+    }
+}
+
+unassemblize::FunctionFingerprint unassemblize::function_fingerprint(
+    const Executable &exe, uint64_t start, uint64_t end)
+{
+    std::vector<uint8_t> bytes;
+    std::vector<uint8_t> mask;
+    std::vector<uint64_t> targets;
+    normalize_function(exe, start, end, bytes, mask, &targets);
+    uint64_t hash = fnv1a_64(bytes.data(), bytes.size());
+
+    if (bytes.empty()) {
+        return {hash, 0};
+    }
+
+    return {hash, fnv1a_64(targets.data(), targets.size() * sizeof(uint64_t), hash)};
+}
@@ -0,0 +1,43 @@
+/**
+ * @file
+ *
+ * @brief Layout independent views of function bytes.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+namespace unassemblize
+{
+class Executable;
+
+/**
+ * Copies the bytes of [start, end) and clears those that depend on the image layout: relative displacements including
+ * RIP relative ones, immediates and displacements pointing into the image and inline jump table entries. mask is 0xFF
+ * for every kept byte and 0 for every cleared one. If targets is given it receives where each cleared field points.
+ */
+void normalize_function(const Executable &exe,
+    uint64_t start,
+    uint64_t end,
+    std::vector<uint8_t> &bytes,
+    std::vector<uint8_t> &mask,
+    std::vector<uint64_t> *targets = nullptr);
+struct FunctionFingerprint
+{
+    uint64_t bytes; // Hash of the normalized bytes alone, what comparisons are cached by.
+    uint64_t body; // Hash of the normalized bytes and of everything they refer to, 0 if the range can't be read.
+};
+
+/**
+ * Fingerprints of [start, end), body is equal for functions that behave identically wherever they are placed.
+ */
+FunctionFingerprint function_fingerprint(const Executable &exe, uint64_t start, uint64_t end);
+} // namespace unassemblize
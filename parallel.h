@@ -0,0 +1,56 @@
+/**
+ * @file
+ *
+ * @brief Minimal helpers for spreading independent work over hardware threads.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <stddef.h>
+#include <thread>
+#include <vector>
+
+namespace unassemblize
+{
+/**
+ * Calls func(i) for every i in [0, count) from a pool of worker threads.
+ * Work items are handed out one at a time so uneven item costs balance out.
+ */
+template<typename Func>
+void parallel_for(size_t count, Func func)
+{
+    size_t thread_count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), count);
+
+    if (thread_count <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            func(i);
+        }
+
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count);
+
+    for (size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&]() {
+            for (size_t i = next++; i < count; i = next++) {
+                func(i);
+            }
+        });
+    }
+
+    for (auto it = threads.begin(); it != threads.end(); ++it) {
+        it->join();
+    }
+}
+} // namespace unassemblize
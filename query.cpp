@@ -0,0 +1,365 @@
+/**
+ * @file
+ *
+ * @brief Instruction sequence queries evaluated against the decoded code index.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#include "query.h"
+#include "codeindex.h"
+#include "parallel.h"
+#include <Zydis/Zydis.h>
+#include <algorithm>
+#include <ctype.h>
+#include <stdlib.h>
+#include <strings.h>
+
+namespace
+{
+std::string trim(const std::string &text)
+{
+    size_t begin = text.find_first_not_of(" \t");
+    size_t end = text.find_last_not_of(" \t");
+
+    return begin == std::string::npos ? std::string() : text.substr(begin, end - begin + 1);
+}
+
+std::vector<std::string> split(const std::string &text, char separator)
+{
+    std::vector<std::string> parts;
+    size_t begin = 0;
+
+    while (true) {
+        size_t end = text.find(separator, begin);
+        parts.push_back(trim(text.substr(begin, end == std::string::npos ? std::string::npos : end - begin)));
+
+        if (end == std::string::npos) {
+            break;
+        }
+
+        begin = end + 1;
+    }
+
+    return parts;
+}
+
+uint16_t find_mnemonic(const std::string &name)
+{
+    for (int i = 0; i <= ZYDIS_MNEMONIC_MAX_VALUE; ++i) {
+        const char *str = ZydisMnemonicGetString(static_cast<ZydisMnemonic>(i));
+
+        if (str != nullptr && strcasecmp(str, name.c_str()) == 0) {
+            return uint16_t(i);
+        }
+    }
+
+    return ZYDIS_MNEMONIC_INVALID;
+}
+
+uint16_t find_register(const std::string &name)
+{
+    for (int i = 1; i <= ZYDIS_REGISTER_MAX_VALUE; ++i) {
+        const char *str = ZydisRegisterGetString(static_cast<ZydisRegister>(i));
+
+        if (str != nullptr && strcasecmp(str, name.c_str()) == 0) {
+            return uint16_t(i);
+        }
+    }
+
+    return ZYDIS_REGISTER_NONE;
+}
+
+bool parse_number(const std::string &text, int64_t &value)
+{
+    if (text.empty() || !(isdigit(uint8_t(text[0])) || text[0] == '-')) {
+        return false;
+    }
+
+    char *end;
+    value = strtoll(text.c_str(), &end, 0);
+
+    return *end == '\0';
+}
+} // namespace
+
+bool unassemblize::InstructionQuery::parse(const char *query, std::string &error)
+{
+    m_patterns.clear();
+    std::vector<std::string> instructions = split(query, ';');
+
+    for (auto it = instructions.begin(); it != instructions.end(); ++it) {
+        if (it->empty()) {
+            continue;
+        }
+
+        InstructionPattern pattern;
+        size_t space = it->find_first_of(" \t");
+        std::string mnemonic = it->substr(0, space);
+        std::string operands = space == std::string::npos ? std::string() : trim(it->substr(space));
+
+        if (mnemonic == "?") {
+            pattern.mnemonic = ZYDIS_MNEMONIC_INVALID;
+        } else {
+            pattern.mnemonic = find_mnemonic(mnemonic);
+
+            if (pattern.mnemonic == ZYDIS_MNEMONIC_INVALID) {
+                error = "unknown mnemonic '" + mnemonic + "'";
+                return false;
+            }
+        }
+
+        pattern.any_operands = operands.empty();
+
+        if (!operands.empty()) {
+            std::vector<std::string> parts = split(operands, ',');
+
+            for (auto part = parts.begin(); part != parts.end(); ++part) {
+                OperandPattern operand;
+
+                if (!parse_operand(*part, operand, error)) {
+                    return false;
+                }
+
+                pattern.operands.push_back(operand);
+            }
+        }
+
+        m_patterns.push_back(pattern);
+    }
+
+    if (m_patterns.empty()) {
+        error = "empty query";
+        return false;
+    }
+
+    return true;
+}
+
+bool unassemblize::InstructionQuery::parse_operand(
+    const std::string &text, OperandPattern &pattern, std::string &error) const
+{
+    pattern = {MATCH_ANY, ZYDIS_REGISTER_NONE, ZYDIS_REGISTER_NONE, 0, false, 0};
+    std::string operand = text;
+
+    // Size hints are allowed for readability but don't take part in matching.
+    size_t ptr = operand.find(" ptr ");
+
+    if (ptr != std::string::npos) {
+        operand = trim(operand.substr(ptr + 5));
+    }
+
+    if (operand == "?") {
+        return true;
+    } else if (strcasecmp(operand.c_str(), "reg") == 0) {
+        pattern.kind = MATCH_ANY_REGISTER;
+        return true;
+    } else if (strcasecmp(operand.c_str(), "imm") == 0) {
+        pattern.kind = MATCH_ANY_IMMEDIATE;
+        return true;
+    } else if (strcasecmp(operand.c_str(), "mem") == 0) {
+        pattern.kind = MATCH_ANY_MEMORY;
+        return true;
+    } else if (!operand.empty() && operand[0] == '[' && operand.back() == ']') {
+        return parse_memory(operand.substr(1, operand.size() - 2), pattern, error);
+    } else if (parse_number(operand, pattern.value)) {
+        pattern.kind = MATCH_IMMEDIATE;
+        return true;
+    }
+
+    pattern.reg = find_register(operand);
+
+    if (pattern.reg == ZYDIS_REGISTER_NONE) {
+        error = "unknown operand '" + operand + "'";
+        return false;
+    }
+
+    pattern.kind = MATCH_REGISTER;
+
+    return true;
+}
+
+bool unassemblize::InstructionQuery::parse_memory(const std::string &text, OperandPattern &pattern, std::string &error) const
+{
+    pattern.kind = MATCH_MEMORY;
+    std::string expr;
+
+    // Rewrite subtraction as addition of a negative term so terms can be split on '+'.
+    for (auto it = text.begin(); it != text.end(); ++it) {
+        if (*it == '-' && it != text.begin()) {
+            expr += "+-";
+        } else if (*it != ' ' && *it != '\t') {
+            expr += *it;
+        }
+    }
+
+    if (expr == "?") {
+        pattern.kind = MATCH_ANY_MEMORY;
+        return true;
+    }
+
+    std::vector<std::string> terms = split(expr, '+');
+
+    for (auto term = terms.begin(); term != terms.end(); ++term) {
+        int64_t value;
+        size_t star = term->find('*');
+
+        if (*term == "?") {
+            pattern.any_disp = true;
+        } else if (parse_number(*term, value)) {
+            pattern.value += value;
+        } else if (star != std::string::npos) {
+            pattern.index = find_register(term->substr(0, star));
+            pattern.scale = uint8_t(atoi(term->substr(star + 1).c_str()));
+
+            if (pattern.index == ZYDIS_REGISTER_NONE || pattern.scale == 0) {
+                error = "bad index term '" + *term + "'";
+                return false;
+            }
+        } else {
+            uint16_t reg = find_register(*term);
+
+            if (reg == ZYDIS_REGISTER_NONE) {
+                error = "unknown register '" + *term + "'";
+                return false;
+            }
+
+            // Second plain register is an unscaled index.
+            if (pattern.reg == ZYDIS_REGISTER_NONE) {
+                pattern.reg = reg;
+            } else {
+                pattern.index = reg;
+                pattern.scale = 1;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool unassemblize::InstructionQuery::match_at(const CodeIndex &code, size_t position) const
+{
+    const std::vector<CodeIndex::Instruction> &instructions = code.instructions();
+
+    if (position + m_patterns.size() > instructions.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < m_patterns.size(); ++i) {
+        const InstructionPattern &pattern = m_patterns[i];
+        const CodeIndex::Instruction &instruction = instructions[position + i];
+
+        // Matches don't continue into the next function.
+        if (i != 0 && instruction.function_start) {
+            return false;
+        }
+
+        if (pattern.mnemonic != ZYDIS_MNEMONIC_INVALID && pattern.mnemonic != instruction.mnemonic) {
+            return false;
+        }
+
+        if (pattern.any_operands) {
+            continue;
+        }
+
+        if (pattern.operands.size() != instruction.operand_count) {
+            return false;
+        }
+
+        for (unsigned op = 0; op < instruction.operand_count; ++op) {
+            const OperandPattern &expected = pattern.operands[op];
+            const CodeIndex::Operand &operand = code.operand(instruction, op);
+            bool is_imm = operand.type == ZYDIS_OPERAND_TYPE_IMMEDIATE || operand.type == ZYDIS_OPERAND_TYPE_POINTER;
+            bool ok = true;
+
+            switch (expected.kind) {
+                case MATCH_ANY:
+                    break;
+                case MATCH_ANY_REGISTER:
+                    ok = operand.type == ZYDIS_OPERAND_TYPE_REGISTER;
+                    break;
+                case MATCH_ANY_IMMEDIATE:
+                    ok = is_imm;
+                    break;
+                case MATCH_ANY_MEMORY:
+                    ok = operand.type == ZYDIS_OPERAND_TYPE_MEMORY;
+                    break;
+                case MATCH_REGISTER:
+                    ok = operand.type == ZYDIS_OPERAND_TYPE_REGISTER && operand.reg == expected.reg;
+                    break;
+                case MATCH_IMMEDIATE:
+                    ok = is_imm && uint64_t(operand.value) == (uint64_t(expected.value) & code.value_mask());
+                    break;
+                case MATCH_MEMORY:
+                    ok = operand.type == ZYDIS_OPERAND_TYPE_MEMORY && operand.reg == expected.reg
+                        && operand.index == expected.index && (expected.index == 0 || operand.scale == expected.scale)
+                        && (expected.any_disp || operand.value == expected.value);
+                    break;
+            }
+
+            if (!ok) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void unassemblize::InstructionQuery::run(const CodeIndex &code, std::vector<uint32_t> &matches) const
+{
+    matches.clear();
+
+    // Use the positions of the rarest adjacent pair of known mnemonics as candidates if there is one.
+    std::vector<uint32_t> candidates;
+    bool have_candidates = false;
+    size_t best_count = SIZE_MAX;
+
+    for (size_t i = 0; i + 1 < m_patterns.size(); ++i) {
+        if (m_patterns[i].mnemonic == ZYDIS_MNEMONIC_INVALID || m_patterns[i + 1].mnemonic == ZYDIS_MNEMONIC_INVALID) {
+            continue;
+        }
+
+        auto range = code.bigram_positions(m_patterns[i].mnemonic, m_patterns[i + 1].mnemonic);
+        size_t count = range.second - range.first;
+
+        if (count < best_count) {
+            best_count = count;
+            have_candidates = true;
+            candidates.clear();
+
+            for (const uint32_t *pos = range.first; pos != range.second; ++pos) {
+                if (*pos >= i) {
+                    candidates.push_back(uint32_t(*pos - i));
+                }
+            }
+        }
+    }
+
+    const size_t total = have_candidates ? candidates.size() : code.instructions().size();
+    const size_t block_size = 64 * 1024;
+    std::vector<std::vector<uint32_t>> block_matches((total + block_size - 1) / block_size);
+
+    // Verification is independent per position so blocks of candidates are checked in parallel.
+    parallel_for(block_matches.size(), [&](size_t block) {
+        size_t end = std::min(total, (block + 1) * block_size);
+
+        for (size_t i = block * block_size; i < end; ++i) {
+            uint32_t position = have_candidates ? candidates[i] : uint32_t(i);
+
+            if (match_at(code, position)) {
+                block_matches[block].push_back(position);
+            }
+        }
+    });
+
+    for (auto it = block_matches.begin(); it != block_matches.end(); ++it) {
+        matches.insert(matches.end(), it->begin(), it->end());
+    }
+
+    std::sort(matches.begin(), matches.end());
+}
@@ -0,0 +1,79 @@
+/**
+ * @file
+ *
+ * @brief Instruction sequence queries evaluated against the decoded code index.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace unassemblize
+{
+class CodeIndex;
+
+/**
+ * Matches sequences of instructions described as "mnemonic operand, operand; mnemonic ...".
+ * A mnemonic or operand of ? matches anything, reg, imm and mem match any operand of that kind.
+ * Registers and numbers match exactly and memory operands are written as [base+index*scale+disp],
+ * where ? in place of the displacement matches any displacement. An instruction without operands in the
+ * query matches the mnemonic regardless of operands.
+ */
+class InstructionQuery
+{
+public:
+    /**
+     * Parses a query, returns false and describes the problem in error if it is malformed.
+     */
+    bool parse(const char *query, std::string &error);
+    /**
+     * Finds the index of the first instruction of every match in the code index.
+     */
+    void run(const CodeIndex &code, std::vector<uint32_t> &matches) const;
+
+private:
+    enum OperandKinds
+    {
+        MATCH_ANY,
+        MATCH_ANY_REGISTER,
+        MATCH_ANY_IMMEDIATE,
+        MATCH_ANY_MEMORY,
+        MATCH_REGISTER,
+        MATCH_IMMEDIATE,
+        MATCH_MEMORY,
+    };
+
+    struct OperandPattern
+    {
+        OperandKinds kind;
+        uint16_t reg; // Register or memory base.
+        uint16_t index;
+        uint8_t scale;
+        bool any_disp;
+        int64_t value; // Immediate or displacement.
+    };
+
+    struct InstructionPattern
+    {
+        uint16_t mnemonic; // ZYDIS_MNEMONIC_INVALID matches any instruction.
+        bool any_operands;
+        std::vector<OperandPattern> operands;
+    };
+
+private:
+    bool parse_operand(const std::string &text, OperandPattern &pattern, std::string &error) const;
+    bool parse_memory(const std::string &text, OperandPattern &pattern, std::string &error) const;
+    bool match_at(const CodeIndex &code, size_t position) const;
+
+private:
+    std::vector<InstructionPattern> m_patterns;
+};
+} // namespace unassemblize
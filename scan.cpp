@@ -0,0 +1,541 @@
+/**
+ * @file
+ *
+ * @brief Vectorized scans over raw section data.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#include "scan.h"
+#include <Zydis/Zydis.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UNASM_HAVE_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+unsigned lowest_set_bit(unsigned mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+bool is_padding(uint8_t byte)
+{
+    return byte == 0xCC || byte == 0x90;
+}
+
+// Previous function ended right before pos with padding or a ret.
+bool follows_boundary(const uint8_t *data, uint64_t pos)
+{
+    if (pos == 0) {
+        return true;
+    }
+
+    uint8_t prev = data[pos - 1];
+
+    if (is_padding(prev) || prev == 0xC3) {
+        return true;
+    }
+
+    // ret imm16, stdcall cleanup sizes are small so the high byte is zero.
+    return pos >= 3 && data[pos - 3] == 0xC2 && prev == 0x00;
+}
+
+// Checks a single position flagged by the vector prefilter, returns the candidate start or UINT64_MAX.
+uint64_t match_prologue(const uint8_t *data, uint64_t size, uint64_t pos)
+{
+    const uint8_t *p = data + pos;
+    uint64_t left = size - pos;
+
+    // push ebp; mov ebp, esp in both MSVC and GAS encodings.
+    if (left >= 3 && p[0] == 0x55 && ((p[1] == 0x8B && p[2] == 0xEC) || (p[1] == 0x89 && p[2] == 0xE5))) {
+        // Hotpatchable functions start with mov edi, edi.
+        if (pos >= 2 && p[-2] == 0x8B && p[-1] == 0xFF) {
+            return pos - 2;
+        }
+
+        return pos;
+    }
+
+    if (!follows_boundary(data, pos) || is_padding(p[0])) {
+        return UINT64_MAX;
+    }
+
+    // sub esp, imm8 / sub esp, imm32
+    if (left >= 3 && p[0] == 0x83 && p[1] == 0xEC) {
+        return pos;
+    }
+
+    if (left >= 6 && p[0] == 0x81 && p[1] == 0xEC) {
+        return pos;
+    }
+
+    // push esi; push edi and push ebx; push esi; push edi
+    if (left >= 2 && p[0] == 0x56 && p[1] == 0x57) {
+        return pos;
+    }
+
+    if (left >= 3 && p[0] == 0x53 && p[1] == 0x56 && p[2] == 0x57) {
+        return pos;
+    }
+
+    // Anything aligned after int3 padding is very likely a function too.
+    if (pos != 0 && data[pos - 1] == 0xCC && (pos & 0xF) == 0) {
+        return pos;
+    }
+
+    return UINT64_MAX;
+}
+
+void check_position(const uint8_t *data, uint64_t size, uint64_t pos, std::vector<uint64_t> &offsets)
+{
+    uint64_t start = match_prologue(data, size, pos);
+
+    if (start != UINT64_MAX) {
+        offsets.push_back(start);
+    }
+}
+
+uint32_t get_le32(const uint8_t *data)
+{
+    return (data[3] << 24) | (data[2] << 16) | (data[1] << 8) | data[0];
+}
+
+uint64_t get_le64(const uint8_t *data)
+{
+    return (uint64_t(get_le32(data + 4)) << 32) | get_le32(data);
+}
+} // namespace
+
+void unassemblize::scan_prologues(const uint8_t *data, uint64_t size, std::vector<uint64_t> &offsets)
+{
+    uint64_t pos = 0;
+
+#ifdef UNASM_HAVE_SSE2
+    // Flag every byte that could begin a pattern or follows int3 padding, then verify the few hits.
+    // Keeps the scan bound by memory bandwidth instead of by instruction decoding.
+    if (size >= 17) {
+        const __m128i push_ebp = _mm_set1_epi8(0x55);
+        const __m128i sub_esp8 = _mm_set1_epi8(char(0x83));
+        const __m128i sub_esp32 = _mm_set1_epi8(char(0x81));
+        const __m128i push_esi = _mm_set1_epi8(0x56);
+        const __m128i push_ebx = _mm_set1_epi8(0x53);
+        const __m128i int3 = _mm_set1_epi8(char(0xCC));
+
+        check_position(data, size, 0, offsets);
+
+        for (pos = 1; pos + 16 <= size; pos += 16) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+            __m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos - 1));
+            __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(bytes, push_ebp), _mm_cmpeq_epi8(bytes, sub_esp8));
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, sub_esp32));
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, push_esi));
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, push_ebx));
+            hits = _mm_or_si128(hits, _mm_andnot_si128(_mm_cmpeq_epi8(bytes, int3), _mm_cmpeq_epi8(prev, int3)));
+            unsigned mask = _mm_movemask_epi8(hits);
+
+            while (mask != 0) {
+                check_position(data, size, pos + lowest_set_bit(mask), offsets);
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+
+    for (; pos < size; ++pos) {
+        check_position(data, size, pos, offsets);
+    }
+}
+
+void unassemblize::scan_pattern(
+    const uint8_t *data, uint64_t size, const char *pattern, uint64_t length, std::vector<uint64_t> &offsets)
+{
+    if (length < 2 || size < length) {
+        return;
+    }
+
+    const uint64_t last = size - length;
+    uint64_t pos = 0;
+
+#ifdef UNASM_HAVE_SSE2
+    // Match the first two bytes sixteen positions at a time, only then compare the rest.
+    const __m128i first = _mm_set1_epi8(pattern[0]);
+    const __m128i second = _mm_set1_epi8(pattern[1]);
+
+    for (; pos + 17 <= size && pos + 15 <= last; pos += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+        __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos + 1));
+        unsigned mask =
+            _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(bytes, first), _mm_cmpeq_epi8(next, second)));
+
+        while (mask != 0) {
+            uint64_t hit = pos + lowest_set_bit(mask);
+
+            if (memcmp(data + hit + 2, pattern + 2, length - 2) == 0) {
+                offsets.push_back(hit);
+            }
+
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; pos <= last; ++pos) {
+        if (memcmp(data + pos, pattern, length) == 0) {
+            offsets.push_back(pos);
+        }
+    }
+}
+
+namespace
+{
+#ifdef UNASM_HAVE_SSE2
+__m128i printable_mask(__m128i bytes)
+{
+    __m128i mask = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x1F)), _mm_cmplt_epi8(bytes, _mm_set1_epi8(0x7F)));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\t')));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')));
+    return _mm_or_si128(mask, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\r')));
+}
+#endif
+
+// Tracks a run of printable characters and records it once it ends on a terminator.
+struct RunTracker
+{
+    const uint8_t *data;
+    uint64_t min_length;
+    uint64_t unit;
+    std::vector<unassemblize::StringRun> &runs;
+    uint64_t start;
+    bool active;
+
+    void printable(uint64_t pos)
+    {
+        if (!active) {
+            start = pos;
+            active = true;
+        }
+    }
+
+    void other(uint64_t pos)
+    {
+        if (active) {
+            uint64_t length = (pos - start) / unit;
+            bool terminated = unit == 1 ? data[pos] == 0 : data[pos] == 0 && data[pos + 1] == 0;
+
+            if (terminated && length >= min_length) {
+                runs.push_back({start, length, unit != 1});
+            }
+
+            active = false;
+        }
+    }
+
+    bool unit_printable(uint64_t pos) const
+    {
+        return unassemblize::is_printable(data[pos]) && (unit == 1 || data[pos + 1] == 0);
+    }
+};
+
+void scan_ascii(const uint8_t *data, uint64_t size, uint64_t limit, RunTracker &tracker)
+{
+    uint64_t pos = 0;
+
+#ifdef UNASM_HAVE_SSE2
+    for (; pos + 16 <= size; pos += 16) {
+        unsigned mask =
+            _mm_movemask_epi8(printable_mask(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos))));
+
+        // Whole blocks of text or of binary data don't need a per byte look.
+        if ((mask == 0xFFFF && tracker.active) || (mask == 0 && !tracker.active)) {
+            continue;
+        }
+
+        for (unsigned bit = 0; bit < 16; ++bit) {
+            if (mask & (1u << bit)) {
+                tracker.printable(pos + bit);
+            } else {
+                tracker.other(pos + bit);
+            }
+        }
+    }
+#endif
+
+    for (; pos < size; ++pos) {
+        if (tracker.unit_printable(pos)) {
+            tracker.printable(pos);
+        } else {
+            tracker.other(pos);
+        }
+    }
+
+    // Let a run that started inside the range finish past its end.
+    for (; tracker.active && pos < limit; ++pos) {
+        if (!tracker.unit_printable(pos)) {
+            tracker.other(pos);
+        }
+    }
+
+    tracker.active = false;
+}
+
+void scan_wide(const uint8_t *data, uint64_t size, uint64_t limit, RunTracker &tracker)
+{
+    uint64_t pos = 0;
+    size &= ~uint64_t(1);
+    limit &= ~uint64_t(1);
+
+#ifdef UNASM_HAVE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+
+    for (; pos + 16 <= size; pos += 16) {
+        __m128i units = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+        // A unit is a printable ASCII character when its low byte is printable and its high byte is zero.
+        __m128i low_ok = _mm_and_si128(printable_mask(units), low_bytes);
+        __m128i high_zero = _mm_andnot_si128(low_bytes, _mm_cmpeq_epi8(units, zero));
+        __m128i ok = _mm_cmpeq_epi16(_mm_or_si128(low_ok, high_zero), _mm_set1_epi16(-1));
+        unsigned mask = _mm_movemask_epi8(ok);
+
+        if ((mask == 0xFFFF && tracker.active) || (mask == 0 && !tracker.active)) {
+            continue;
+        }
+
+        for (unsigned bit = 0; bit < 16; bit += 2) {
+            if (mask & (1u << bit)) {
+                tracker.printable(pos + bit);
+            } else {
+                tracker.other(pos + bit);
+            }
+        }
+    }
+#endif
+
+    for (; pos + 2 <= size; pos += 2) {
+        if (tracker.unit_printable(pos)) {
+            tracker.printable(pos);
+        } else {
+            tracker.other(pos);
+        }
+    }
+
+    for (; tracker.active && pos + 2 <= limit; pos += 2) {
+        if (!tracker.unit_printable(pos)) {
+            tracker.other(pos);
+        }
+    }
+
+    tracker.active = false;
+}
+} // namespace
+
+void unassemblize::scan_strings(
+    const uint8_t *data, uint64_t size, uint64_t limit, uint64_t min_length, std::vector<StringRun> &runs)
+{
+    RunTracker ascii = {data, min_length, 1, runs, 0, false};
+    scan_ascii(data, size, limit, ascii);
+    RunTracker wide = {data, min_length, 2, runs, 0, false};
+    scan_wide(data, size, limit, wide);
+}
+
+bool unassemblize::is_function_start(const uint8_t *data, uint64_t size, uint64_t pos)
+{
+    return pos < size && (match_prologue(data, size, pos) == pos || follows_boundary(data, pos));
+}
+
+void unassemblize::scan_pointers(const uint8_t *data, uint64_t size, uint64_t address, uint32_t ptr_size, uint64_t low,
+    uint64_t high, std::vector<uint64_t> &offsets)
+{
+    uint64_t pos = (ptr_size - (address & (ptr_size - 1))) & (ptr_size - 1);
+
+    if (ptr_size == sizeof(uint64_t)) {
+        for (; pos + sizeof(uint64_t) <= size; pos += sizeof(uint64_t)) {
+            uint64_t value = get_le64(data + pos);
+
+            if (value >= low && value < high) {
+                offsets.push_back(pos);
+            }
+        }
+
+        return;
+    }
+
+    // An empty range would wrap high - 1 below and let the vector compare accept everything.
+    if (low > UINT32_MAX || low >= high) {
+        return;
+    }
+
+    high = high > UINT32_MAX ? uint64_t(UINT32_MAX) + 1 : high;
+
+#ifdef UNASM_HAVE_SSE2
+    // SSE2 only has signed compares, bias both sides so unsigned ordering is preserved.
+    const __m128i bias = _mm_set1_epi32(INT32_MIN);
+    const __m128i low_vec = _mm_xor_si128(_mm_set1_epi32(int32_t(uint32_t(low))), bias);
+    const __m128i high_vec = _mm_xor_si128(_mm_set1_epi32(int32_t(uint32_t(high - 1))), bias);
+
+    for (; pos + 16 <= size; pos += 16) {
+        __m128i values = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos)), bias);
+        __m128i outside = _mm_or_si128(_mm_cmplt_epi32(values, low_vec), _mm_cmpgt_epi32(values, high_vec));
+        unsigned mask = ~_mm_movemask_ps(_mm_castsi128_ps(outside)) & 0xF;
+
+        while (mask != 0) {
+            offsets.push_back(pos + lowest_set_bit(mask) * sizeof(uint32_t));
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; pos + sizeof(uint32_t) <= size; pos += sizeof(uint32_t)) {
+        uint32_t value = get_le32(data + pos);
+
+        if (value >= low && value < high) {
+            offsets.push_back(pos);
+        }
+    }
+}
+
+uint64_t unassemblize::count_words_in_range(const uint8_t *data, uint64_t size, uint64_t low, uint64_t high)
+{
+    if (low > high || low > UINT32_MAX) {
+        return 0;
+    }
+
+    high = high > UINT32_MAX ? UINT32_MAX : high;
+    uint64_t count = 0;
+    uint64_t pos = 0;
+
+#ifdef UNASM_HAVE_SSE2
+    const __m128i bias = _mm_set1_epi32(INT32_MIN);
+    const __m128i low_vec = _mm_xor_si128(_mm_set1_epi32(int32_t(uint32_t(low))), bias);
+    const __m128i high_vec = _mm_xor_si128(_mm_set1_epi32(int32_t(uint32_t(high))), bias);
+
+    // Eight words per step, the first lane outside the range ends the table.
+    for (; pos + 32 <= size; pos += 32, count += 8) {
+        __m128i first = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos)), bias);
+        __m128i second = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos + 16)), bias);
+        __m128i first_out = _mm_or_si128(_mm_cmplt_epi32(first, low_vec), _mm_cmpgt_epi32(first, high_vec));
+        __m128i second_out = _mm_or_si128(_mm_cmplt_epi32(second, low_vec), _mm_cmpgt_epi32(second, high_vec));
+        unsigned mask = _mm_movemask_ps(_mm_castsi128_ps(first_out)) | (_mm_movemask_ps(_mm_castsi128_ps(second_out)) << 4);
+
+        if (mask != 0) {
+            return count + lowest_set_bit(mask);
+        }
+    }
+#endif
+
+    for (; pos + sizeof(uint32_t) <= size; pos += sizeof(uint32_t), ++count) {
+        uint32_t value = get_le32(data + pos);
+
+        if (value < low || value > high) {
+            break;
+        }
+    }
+
+    return count;
+}
+
+bool unassemblize::masked_equal(
+    const uint8_t *a, const uint8_t *mask_a, const uint8_t *b, const uint8_t *mask_b, uint64_t size)
+{
+    uint64_t pos = 0;
+
+#ifdef UNASM_HAVE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; pos + 16 <= size; pos += 16) {
+        __m128i diff = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + pos)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + pos)));
+        __m128i mask = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(mask_a + pos)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(mask_b + pos)));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(diff, mask), zero)) != 0xFFFF) {
+            return false;
+        }
+    }
+#endif
+
+    for (; pos < size; ++pos) {
+        if (((a[pos] ^ b[pos]) & mask_a[pos] & mask_b[pos]) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool unassemblize::looks_like_code(const uint8_t *data, uint64_t size, bool is_64)
+{
+    const uint64_t window = 256;
+    const uint64_t samples = 64;
+    ZydisDecoder decoder;
+
+    if (is_64) {
+        ZydisDecoderInit(&decoder, ZYDIS_MACHINE_MODE_LONG_64, ZYDIS_STACK_WIDTH_64);
+    } else {
+        ZydisDecoderInit(&decoder, ZYDIS_MACHINE_MODE_LEGACY_32, ZYDIS_STACK_WIDTH_32);
+    }
+
+    // Only lengths are needed, skip operand decoding.
+    ZydisDecoderEnableMode(&decoder, ZYDIS_DECODER_MODE_MINIMAL, ZYAN_TRUE);
+
+    uint64_t histogram[256] = {0};
+    uint64_t sampled = 0;
+    uint64_t decoded = 0;
+    uint64_t failed = 0;
+    uint64_t step = size / samples > window ? size / samples : window;
+
+    for (uint64_t pos = 0; pos < size; pos += step) {
+        uint64_t end = pos + window < size ? pos + window : size;
+
+        for (uint64_t i = pos; i < end; ++i) {
+            ++histogram[data[i]];
+        }
+
+        sampled += end - pos;
+
+        for (uint64_t i = pos; i < end;) {
+            ZydisDecodedInstruction instruction;
+
+            if (ZYAN_SUCCESS(ZydisDecoderDecodeInstruction(&decoder, nullptr, data + i, size - i, &instruction))) {
+                decoded += instruction.length;
+                i += instruction.length;
+            } else {
+                ++failed;
+                ++i;
+            }
+        }
+    }
+
+    if (sampled == 0) {
+        return false;
+    }
+
+    double entropy = 0.0;
+
+    for (int i = 0; i < 256; ++i) {
+        if (histogram[i] != 0) {
+            double p = double(histogram[i]) / double(sampled);
+            entropy -= p * log2(p);
+        }
+    }
+
+    return decoded >= (decoded + failed) * 95 / 100 && entropy >= 4.5 && entropy <= 7.2;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file
+ *
+ * @brief Vectorized scans over raw section data.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+namespace unassemblize
+{
+/**
+ * Finds offsets of likely x86 function prologues in a code section.
+ * push ebp; mov ebp, esp is accepted anywhere, weaker patterns only directly after padding or a ret.
+ */
+void scan_prologues(const uint8_t *data, uint64_t size, std::vector<uint64_t> &offsets);
+/**
+ * Checks if pos looks like the start of a function, either a prologue or directly after padding or a ret.
+ */
+bool is_function_start(const uint8_t *data, uint64_t size, uint64_t pos);
+struct StringRun
+{
+    uint64_t offset;
+    uint64_t length; // Length in characters excluding the terminator.
+    bool wide; // UTF-16LE rather than ASCII.
+};
+
+/**
+ * Finds NUL terminated runs of printable ASCII and UTF-16LE characters of at least min_length characters.
+ * Runs may only start before size but are allowed to continue up to limit.
+ */
+void scan_strings(const uint8_t *data, uint64_t size, uint64_t limit, uint64_t min_length, std::vector<StringRun> &runs);
+/**
+ * Checks if a byte is printable as part of a string literal.
+ */
+inline bool is_printable(uint8_t byte)
+{
+    return (byte >= 0x20 && byte < 0x7F) || byte == '\t' || byte == '\n' || byte == '\r';
+}
+/**
+ * Finds offsets of every occurrence of a byte pattern of at least two bytes.
+ */
+void scan_pattern(const uint8_t *data, uint64_t size, const char *pattern, uint64_t length, std::vector<uint64_t> &offsets);
+/**
+ * Counts the consecutive little endian 32 bit words at the start of data that lie within [low, high].
+ * Used to find the extent of inline jump tables.
+ */
+uint64_t count_words_in_range(const uint8_t *data, uint64_t size, uint64_t low, uint64_t high);
+/**
+ * Finds offsets of naturally aligned pointer sized values in [low, high).
+ * address is the runtime address of data and is used to determine alignment.
+ */
+void scan_pointers(const uint8_t *data, uint64_t size, uint64_t address, uint32_t ptr_size, uint64_t low, uint64_t high,
+    std::vector<uint64_t> &offsets);
+/**
+ * Checks if two byte ranges are equal everywhere both masks are 0xFF, bytes cleared in either mask are ignored.
+ */
+bool masked_equal(const uint8_t *a, const uint8_t *mask_a, const uint8_t *b, const uint8_t *mask_b, uint64_t size);
+/**
+ * Samples a section to guess if it holds code, most windows have to decode cleanly and the byte entropy has to be in
+ * the range typical for x86 machine code rather than that of tables, text or compressed data.
+ */
+bool looks_like_code(const uint8_t *data, uint64_t size, bool is_64);
+} // namespace unassemblize
@@ -0,0 +1,175 @@
+/**
+ * @file
+ *
+ * @brief Index of string literals found in the data sections of an executable.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#include "stringindex.h"
+#include "executable.h"
+#include "parallel.h"
+#include "scan.h"
+#include <algorithm>
+
+namespace
+{
+const uint64_t s_minStringLength = 4;
+
+uint32_t trigram(const char *text)
+{
+    return (uint8_t(text[0]) << 16) | (uint8_t(text[1]) << 8) | uint8_t(text[2]);
+}
+} // namespace
+
+void unassemblize::StringIndex::build(const Executable &exe)
+{
+    // Same chunking as the other data section scans, runs crossing a chunk end belong to the chunk they start in.
+    const uint64_t chunk_size = 1024 * 1024;
+    std::vector<std::pair<const Executable::SectionInfo *, uint64_t>> chunks;
+
+    for (auto it = exe.sections().begin(); it != exe.sections().end(); ++it) {
+        if (it->second.type != Executable::SECTION_DATA) {
+            continue;
+        }
+
+        for (uint64_t offset = 0; offset < it->second.size; offset += chunk_size) {
+            chunks.push_back({&it->second, offset});
+        }
+    }
+
+    std::vector<std::vector<StringRun>> chunk_runs(chunks.size());
+
+    parallel_for(chunks.size(), [&](size_t i) {
+        const Executable::SectionInfo &section = *chunks[i].first;
+        uint64_t offset = chunks[i].second;
+        const uint8_t *data = section.data + offset;
+        std::vector<StringRun> &runs = chunk_runs[i];
+        scan_strings(data, std::min(chunk_size, section.size - offset), section.size - offset, s_minStringLength, runs);
+
+        // Drop the tail of a run owned by the previous chunk.
+        if (offset != 0) {
+            runs.erase(std::remove_if(runs.begin(),
+                           runs.end(),
+                           [&](const StringRun &run) {
+                               return run.offset == 0
+                                   && (run.wide ? data[-1] == 0 && is_printable(data[-2]) : is_printable(data[-1]));
+                           }),
+                runs.end());
+        }
+    });
+
+    m_entries.clear();
+    m_pool.clear();
+
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        const Executable::SectionInfo &section = *chunks[i].first;
+        const uint8_t *data = section.data + chunks[i].second;
+
+        for (auto run = chunk_runs[i].begin(); run != chunk_runs[i].end(); ++run) {
+            Entry entry = {section.address + chunks[i].second + run->offset,
+                uint32_t(m_pool.size()),
+                uint32_t(run->length),
+                run->wide};
+
+            if (run->wide) {
+                for (uint64_t c = 0; c < run->length; ++c) {
+                    m_pool += char(data[run->offset + c * 2]);
+                }
+            } else {
+                m_pool.append(reinterpret_cast<const char *>(data + run->offset), run->length);
+            }
+
+            m_entries.push_back(entry);
+        }
+    }
+
+    std::sort(m_entries.begin(), m_entries.end(), [](const Entry &a, const Entry &b) { return a.address < b.address; });
+}
+
+void unassemblize::StringIndex::build_search_index()
+{
+    m_trigrams.clear();
+
+    for (size_t i = 0; i < m_entries.size(); ++i) {
+        const char *text = m_pool.data() + m_entries[i].offset;
+
+        for (uint32_t pos = 0; pos + 3 <= m_entries[i].length; ++pos) {
+            m_trigrams.push_back({trigram(text + pos), uint32_t(i)});
+        }
+    }
+
+    std::sort(m_trigrams.begin(), m_trigrams.end());
+    m_trigrams.erase(std::unique(m_trigrams.begin(), m_trigrams.end()), m_trigrams.end());
+    m_trigrams.shrink_to_fit();
+}
+
+const unassemblize::StringIndex::Entry *unassemblize::StringIndex::find(uint64_t addr) const
+{
+    auto it = std::lower_bound(
+        m_entries.begin(), m_entries.end(), addr, [](const Entry &entry, uint64_t value) { return entry.address < value; });
+
+    return it != m_entries.end() && it->address == addr ? &*it : nullptr;
+}
+
+void unassemblize::StringIndex::search(const std::string &needle, std::vector<size_t> &results) const
+{
+    results.clear();
+
+    auto matches = [&](size_t i) {
+        const Entry &entry = m_entries[i];
+        return needle.size() <= entry.length
+            && std::search(m_pool.begin() + entry.offset,
+                   m_pool.begin() + entry.offset + entry.length,
+                   needle.begin(),
+                   needle.end())
+            != m_pool.begin() + entry.offset + entry.length;
+    };
+
+    // Too short for a trigram or no index built, check everything.
+    if (needle.size() < 3 || m_trigrams.empty()) {
+        for (size_t i = 0; i < m_entries.size(); ++i) {
+            if (matches(i)) {
+                results.push_back(i);
+            }
+        }
+
+        return;
+    }
+
+    // Only verify the entries listed for the rarest trigram of the needle.
+    auto best_begin = m_trigrams.end();
+    auto best_end = m_trigrams.end();
+    size_t best_count = SIZE_MAX;
+
+    for (size_t pos = 0; pos + 3 <= needle.size(); ++pos) {
+        uint32_t key = trigram(needle.c_str() + pos);
+        auto range = std::equal_range(m_trigrams.begin(),
+            m_trigrams.end(),
+            std::make_pair(key, uint32_t(0)),
+            [](const std::pair<uint32_t, uint32_t> &a, const std::pair<uint32_t, uint32_t> &b) {
+                return a.first < b.first;
+            });
+        size_t count = range.second - range.first;
+
+        if (count < best_count) {
+            best_begin = range.first;
+            best_end = range.second;
+            best_count = count;
+        }
+
+        if (count == 0) {
+            return;
+        }
+    }
+
+    for (auto it = best_begin; it != best_end; ++it) {
+        if (matches(it->second)) {
+            results.push_back(it->second);
+        }
+    }
+}
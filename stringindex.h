@@ -0,0 +1,60 @@
+/**
+ * @file
+ *
+ * @brief Index of string literals found in the data sections of an executable.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace unassemblize
+{
+class Executable;
+
+class StringIndex
+{
+public:
+    struct Entry
+    {
+        uint64_t address;
+        uint32_t offset; // Offset of the text in the string pool.
+        uint32_t length;
+        bool wide;
+    };
+
+public:
+    /**
+     * Collects ASCII and UTF-16LE strings from all data sections, wide strings are stored narrowed.
+     */
+    void build(const Executable &exe);
+    /**
+     * Builds the trigram index used by search, only needed for substring queries.
+     */
+    void build_search_index();
+    const std::vector<Entry> &entries() const { return m_entries; }
+    /**
+     * Returns the string starting exactly at addr or nullptr.
+     */
+    const Entry *find(uint64_t addr) const;
+    std::string text(const Entry &entry) const { return m_pool.substr(entry.offset, entry.length); }
+    /**
+     * Finds indices of all entries containing needle.
+     */
+    void search(const std::string &needle, std::vector<size_t> &results) const;
+
+private:
+    std::vector<Entry> m_entries; // Sorted by address.
+    std::string m_pool;
+    std::vector<std::pair<uint32_t, uint32_t>> m_trigrams; // Sorted trigram and entry index pairs.
+};
+} // namespace unassemblize
@@ -0,0 +1,337 @@
+/**
+ * @file
+ *
+ * @brief Side table of where symbol names were written in output files.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#include "symbolspans.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace
+{
+const char s_magic[8] = {'U', 'N', 'A', 'S', 'M', 'S', 'P', '\0'};
+
+// All values are stored in host byte order like the analysis database.
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t file_count;
+    uint32_t name_count;
+    uint32_t reserved;
+    uint64_t span_count;
+    uint64_t strings_size; // File paths then symbol names, NUL terminated, padded to 8 bytes.
+};
+
+// Copies count bytes, or everything up to the end of the input if count is UINT64_MAX.
+bool copy_bytes(FILE *in, FILE *out, uint64_t count, std::vector<char> &buffer)
+{
+    while (count != 0) {
+        size_t chunk = size_t(std::min<uint64_t>(count, buffer.size()));
+        size_t read = fread(buffer.data(), 1, chunk, in);
+
+        if (fwrite(buffer.data(), 1, read, out) != read) {
+            return false;
+        }
+
+        if (read != chunk) {
+            return count == UINT64_MAX && feof(in);
+        }
+
+        if (count != UINT64_MAX) {
+            count -= read;
+        }
+    }
+
+    return true;
+}
+
+bool replace_file(const std::string &temp, const std::string &path, bool ok)
+{
+    std::error_code error;
+
+    if (ok) {
+        std::filesystem::rename(temp, path, error);
+    }
+
+    if (!ok || error) {
+        std::filesystem::remove(temp, error);
+        return false;
+    }
+
+    return true;
+}
+
+// Streams path to a copy with old_name replaced at each offset, then swaps the copy in.
+bool rewrite_file(const std::string &path, const std::vector<uint64_t> &offsets, const char *old_name,
+    const char *new_name, std::vector<char> &buffer)
+{
+    const size_t old_length = strlen(old_name);
+    const size_t new_length = strlen(new_name);
+    const std::string temp = path + ".tmp";
+    FILE *in = fopen(path.c_str(), "rb");
+
+    if (in == nullptr) {
+        return false;
+    }
+
+    FILE *out = fopen(temp.c_str(), "wb");
+
+    if (out == nullptr) {
+        fclose(in);
+        return false;
+    }
+
+    std::vector<char> found(old_length);
+    uint64_t position = 0;
+    bool ok = true;
+
+    for (auto it = offsets.begin(); it != offsets.end() && ok; ++it) {
+        // The table is stale if the name isn't where it was written, leave the file alone then.
+        ok = *it >= position && copy_bytes(in, out, *it - position, buffer)
+            && fread(found.data(), 1, old_length, in) == old_length && memcmp(found.data(), old_name, old_length) == 0
+            && fwrite(new_name, 1, new_length, out) == new_length;
+        position = *it + old_length;
+    }
+
+    ok = ok && copy_bytes(in, out, UINT64_MAX, buffer);
+    fclose(in);
+    ok = fclose(out) == 0 && ok;
+
+    return replace_file(temp, path, ok);
+}
+
+size_t previous_tab(const std::string &line, size_t position)
+{
+    return position == std::string::npos || position == 0 ? std::string::npos : line.rfind('\t', position - 1);
+}
+
+// Shifts the offsets and lengths of an offset index written next to an output file, if there is one.
+bool rewrite_index(
+    const std::string &path, const std::vector<uint64_t> &offsets, const char *old_name, const char *new_name)
+{
+    std::ifstream in(path);
+
+    if (!in.good()) {
+        return true;
+    }
+
+    const int64_t delta = int64_t(strlen(new_name)) - int64_t(strlen(old_name));
+    const std::string temp = path + ".tmp";
+    std::ofstream out(temp);
+    std::string line;
+    bool header = true;
+
+    while (std::getline(in, line)) {
+        // Fields are found from the end, a name could hold any character but a newline.
+        size_t length_tab = line.rfind('\t');
+        size_t offset_tab = previous_tab(line, length_tab);
+        size_t address_tab = previous_tab(line, offset_tab);
+
+        if (header || address_tab == std::string::npos) {
+            out << line << '\n';
+            header = false;
+            continue;
+        }
+
+        std::string name = line.substr(0, address_tab);
+        uint64_t offset = strtoull(line.c_str() + offset_tab + 1, nullptr, 10);
+        uint64_t length = strtoull(line.c_str() + length_tab + 1, nullptr, 10);
+        const int64_t before = std::lower_bound(offsets.begin(), offsets.end(), offset) - offsets.begin();
+        const int64_t inside = std::lower_bound(offsets.begin(), offsets.end(), offset + length) - offsets.begin() - before;
+
+        out << (name == old_name ? std::string(new_name) : name) << line.substr(address_tab, offset_tab - address_tab)
+            << '\t' << offset + before * delta << '\t' << length + inside * delta << '\n';
+    }
+
+    in.close();
+    out.close();
+
+    return replace_file(temp, path, out.good());
+}
+} // namespace
+
+void unassemblize::SymbolSpans::add(uint64_t offset, const char *name, size_t length)
+{
+    auto result = m_ids.emplace(std::string(name, length), uint32_t(m_names.size()));
+
+    if (result.second) {
+        m_names.push_back(result.first->first);
+    }
+
+    m_spans.push_back({offset, uint32_t(m_files.empty() ? 0 : m_files.size() - 1), result.first->second});
+}
+
+bool unassemblize::SymbolSpans::save(const char *file_name) const
+{
+    FILE *fp = fopen(file_name, "wb");
+
+    if (fp == nullptr) {
+        return false;
+    }
+
+    std::string strings;
+
+    for (auto it = m_files.begin(); it != m_files.end(); ++it) {
+        strings.append(it->c_str(), it->size() + 1);
+    }
+
+    for (auto it = m_names.begin(); it != m_names.end(); ++it) {
+        strings.append(it->c_str(), it->size() + 1);
+    }
+
+    strings.resize((strings.size() + 7) & ~size_t(7), '\0');
+
+    FileHeader header;
+    memcpy(header.magic, s_magic, sizeof(header.magic));
+    header.version = SPANS_VERSION;
+    header.file_count = uint32_t(m_files.size());
+    header.name_count = uint32_t(m_names.size());
+    header.reserved = 0;
+    header.span_count = m_spans.size();
+    header.strings_size = strings.size();
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+        && fwrite(strings.data(), 1, strings.size(), fp) == strings.size()
+        && fwrite(m_spans.data(), sizeof(Span), m_spans.size(), fp) == m_spans.size();
+
+    return fclose(fp) == 0 && ok;
+}
+
+bool unassemblize::SymbolSpans::load(const char *file_name)
+{
+    *this = SymbolSpans();
+    FILE *fp = fopen(file_name, "rb");
+
+    if (fp == nullptr) {
+        return false;
+    }
+
+    std::error_code error;
+    const uint64_t size = std::filesystem::file_size(file_name, error);
+    FileHeader header;
+    bool ok = !error && fread(&header, sizeof(header), 1, fp) == 1 && memcmp(header.magic, s_magic, sizeof(s_magic)) == 0
+        && header.version == SPANS_VERSION && header.strings_size % 8 == 0;
+
+    // The sizes in the header are checked against the file before anything is allocated for them.
+    ok = ok && header.strings_size <= size - sizeof(header)
+        && header.span_count == (size - sizeof(header) - header.strings_size) / sizeof(Span);
+    std::string strings;
+
+    if (ok) {
+        strings.resize(size_t(header.strings_size));
+        m_spans.resize(size_t(header.span_count));
+        ok = fread(&strings[0], 1, strings.size(), fp) == strings.size()
+            && fread(m_spans.data(), sizeof(Span), m_spans.size(), fp) == m_spans.size();
+    }
+
+    fclose(fp);
+
+    for (size_t position = 0, i = 0; ok && i < size_t(header.file_count) + header.name_count; ++i) {
+        size_t end = strings.find('\0', position);
+
+        if (end == std::string::npos) {
+            ok = false;
+            break;
+        }
+
+        std::string value = strings.substr(position, end - position);
+        position = end + 1;
+
+        if (i < header.file_count) {
+            m_files.push_back(value);
+        } else {
+            m_ids.emplace(value, uint32_t(m_names.size()));
+            m_names.push_back(value);
+        }
+    }
+
+    for (auto it = m_spans.begin(); ok && it != m_spans.end(); ++it) {
+        ok = it->file < m_files.size() && it->symbol < m_names.size();
+    }
+
+    if (!ok) {
+        *this = SymbolSpans();
+    }
+
+    return ok;
+}
+
+int64_t unassemblize::SymbolSpans::rename(const char *file_name, const char *old_name, const char *new_name)
+{
+    SymbolSpans table;
+
+    if (*old_name == '\0' || *new_name == '\0' || !table.load(file_name)) {
+        return -1;
+    }
+
+    auto old_it = table.m_ids.find(old_name);
+
+    if (old_it == table.m_ids.end()) {
+        return 0;
+    }
+
+    const uint32_t old_id = old_it->second;
+    auto new_it = table.m_ids.find(new_name);
+    uint32_t new_id = new_it != table.m_ids.end() ? new_it->second : uint32_t(table.m_names.size());
+
+    // The old name keeps its entry for the spans of any file that fails below.
+    if (new_id == table.m_names.size()) {
+        table.m_names.push_back(new_name);
+    }
+
+    const int64_t delta = int64_t(strlen(new_name)) - int64_t(strlen(old_name));
+    const std::filesystem::path directory = std::filesystem::path(file_name).parent_path();
+    std::vector<char> buffer(1 << 20);
+    std::vector<uint64_t> offsets;
+    int64_t renamed = 0;
+    bool ok = true;
+
+    // Spans are sorted by file and offset, so each file is one run that is streamed once.
+    for (size_t first = 0, last = 0; first < table.m_spans.size() && ok; first = last) {
+        const uint32_t file = table.m_spans[first].file;
+        offsets.clear();
+
+        for (last = first; last < table.m_spans.size() && table.m_spans[last].file == file; ++last) {
+            if (table.m_spans[last].symbol == old_id) {
+                offsets.push_back(table.m_spans[last].offset);
+            }
+        }
+
+        if (offsets.empty()) {
+            continue;
+        }
+
+        const std::string path = (directory / table.m_files[file]).string();
+        ok = rewrite_file(path, offsets, old_name, new_name, buffer);
+
+        if (!ok) {
+            break;
+        }
+
+        for (size_t i = first; i < last; ++i) {
+            Span &span = table.m_spans[i];
+            span.offset += (std::lower_bound(offsets.begin(), offsets.end(), span.offset) - offsets.begin()) * delta;
+            span.symbol = span.symbol == old_id ? new_id : span.symbol;
+        }
+
+        renamed += offsets.size();
+        ok = rewrite_index(path + ".idx", offsets, old_name, new_name);
+    }
+
+    // Saved even after a failure so the table matches the files that were already rewritten.
+    ok = table.save(file_name) && ok;
+
+    return ok ? renamed : -1;
+}
@@ -0,0 +1,65 @@
+/**
+ * @file
+ *
+ * @brief Side table of where symbol names were written in output files.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace unassemblize
+{
+/**
+ * Byte offset of every symbol name written to a set of output files, so a symbol can be renamed by patching only those
+ * bytes instead of dissassembling again. The file is a header, the file paths and symbol names as NUL terminated
+ * strings and an array of fixed size spans sorted by file and offset.
+ */
+class SymbolSpans
+{
+public:
+    enum
+    {
+        SPANS_VERSION = 1,
+    };
+
+    struct Span
+    {
+        uint64_t offset;
+        uint32_t file;
+        uint32_t symbol;
+    };
+
+public:
+    /**
+     * Starts a new output file, spans added afterwards belong to it. The path is relative to the table's directory.
+     */
+    void add_file(const std::string &path) { m_files.push_back(path); }
+    void add(uint64_t offset, const char *name, size_t length);
+    bool empty() const { return m_spans.empty(); }
+    bool save(const char *file_name) const;
+    bool load(const char *file_name);
+    /**
+     * Replaces old_name with new_name at every span of the table in file_name, streaming each affected output file to
+     * a copy. The table and any output.idx offset index are updated to the shifted offsets. Returns the number of spans
+     * rewritten, or -1 if a file couldn't be rewritten or no longer holds old_name where the table says it does.
+     */
+    static int64_t rename(const char *file_name, const char *old_name, const char *new_name);
+
+private:
+    std::vector<std::string> m_files;
+    std::vector<std::string> m_names;
+    std::vector<Span> m_spans;
+    std::unordered_map<std::string, uint32_t> m_ids; // Index into m_names by name.
+};
+} // namespace unassemblize
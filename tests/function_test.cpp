@@ -0,0 +1,74 @@
+/**
+ * @file
+ *
+ * @brief Checks of the per function analysis on small hand assembled images.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#include "executable.h"
+#include "function.h"
+#include "testimage.h"
+#include <LIEF/LIEF.hpp>
+#include <filesystem>
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+using namespace unassemblize::test;
+
+// Code only reached through a local call must be emitted as instructions under the label the call refers to.
+bool test_local_call()
+{
+    static const uint8_t code[] = {
+        0xE8, 0x05, 0x00, 0x00, 0x00, // call +5
+        0xC3, // ret
+        0x90, 0x90, 0x90, 0x90, // padding
+        0x31, 0xC0, // xor eax, eax
+        0xC3, // ret
+    };
+
+    const std::string path = (std::filesystem::temp_directory_path() / "unassemblize_local_call.elf").string();
+    const std::vector<ImageSection> sections = {{".text", FLAGS_CODE, std::vector<uint8_t>(code, code + sizeof(code))}};
+
+    if (!check(write_elf(path, sections), "writing the test image")) {
+        return false;
+    }
+
+    const uint64_t start = section_address(sections, 0);
+    unassemblize::Executable exe(path.c_str());
+    unassemblize::Function func(exe, ".text", start, start + sizeof(code) - 1);
+    func.disassemble(unassemblize::Function::FORMAT_IGAS);
+
+    bool target_reachable = false;
+
+    for (auto it = func.instructions().begin(); it != func.instructions().end(); ++it) {
+        if (it->offset == 10) {
+            target_reachable = it->reachable != 0;
+        }
+    }
+
+    char label[32];
+    snprintf(label, sizeof(label), "loc_%llx:\n", (unsigned long long)(start + 10));
+
+    bool ok = check(target_reachable, "local call target is reachable")
+        && check(func.dissassembly().find(label) != std::string::npos, "local call target label is defined")
+        && check(func.unreachable_bytes() == 4, "only the padding is emitted as data");
+
+    std::filesystem::remove(path);
+
+    return ok;
+}
+} // namespace
+
+int main()
+{
+    bool ok = test_local_call();
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,406 @@
+/**
+ * @file
+ *
+ * @brief Checks of the vectorized scans against plain byte by byte references.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#include "executable.h"
+#include "scan.h"
+#include "stringindex.h"
+#include "testimage.h"
+#include <LIEF/LIEF.hpp>
+#include <filesystem>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+using namespace unassemblize::test;
+
+// Sizes up to here cover empty input, partial and whole vector blocks and the scalar tail behind them.
+const uint64_t s_maxSize = 100;
+const uint32_t s_seed = 0x554E4153;
+
+uint32_t read32(const uint8_t *data)
+{
+    return uint32_t(data[0]) | (uint32_t(data[1]) << 8) | (uint32_t(data[2]) << 16) | (uint32_t(data[3]) << 24);
+}
+
+void write32(uint8_t *data, uint32_t value)
+{
+    data[0] = uint8_t(value);
+    data[1] = uint8_t(value >> 8);
+    data[2] = uint8_t(value >> 16);
+    data[3] = uint8_t(value >> 24);
+}
+
+// Random bytes drawn from a small alphabet so the patterns a scan looks for are frequent.
+void fill_random(std::mt19937 &random, uint8_t *data, uint64_t size, const std::vector<uint8_t> &alphabet)
+{
+    for (uint64_t i = 0; i < size; ++i) {
+        data[i] = alphabet[random() % alphabet.size()];
+    }
+}
+
+uint64_t reference_count_words(const uint8_t *data, uint64_t size, uint64_t low, uint64_t high)
+{
+    uint64_t count = 0;
+
+    for (uint64_t pos = 0; pos + 4 <= size && read32(data + pos) >= low && read32(data + pos) <= high; pos += 4) {
+        ++count;
+    }
+
+    return count;
+}
+
+void reference_pointers(const uint8_t *data, uint64_t size, uint64_t address, uint64_t low, uint64_t high,
+    std::vector<uint64_t> &offsets)
+{
+    for (uint64_t pos = (4 - (address & 3)) & 3; pos + 4 <= size; pos += 4) {
+        if (read32(data + pos) >= low && read32(data + pos) < high) {
+            offsets.push_back(pos);
+        }
+    }
+}
+
+void reference_pattern(const uint8_t *data, uint64_t size, const char *pattern, uint64_t length,
+    std::vector<uint64_t> &offsets)
+{
+    for (uint64_t pos = 0; length >= 2 && pos + length <= size; ++pos) {
+        if (memcmp(data + pos, pattern, length) == 0) {
+            offsets.push_back(pos);
+        }
+    }
+}
+
+bool reference_boundary(const uint8_t *data, uint64_t pos)
+{
+    if (pos == 0) {
+        return true;
+    }
+
+    const uint8_t prev = data[pos - 1];
+
+    return prev == 0xCC || prev == 0x90 || prev == 0xC3 || (pos >= 3 && data[pos - 3] == 0xC2 && prev == 0x00);
+}
+
+void reference_prologues(const uint8_t *data, uint64_t size, std::vector<uint64_t> &offsets)
+{
+    for (uint64_t pos = 0; pos < size; ++pos) {
+        const uint8_t *p = data + pos;
+        const uint64_t left = size - pos;
+
+        if (left >= 3 && p[0] == 0x55 && ((p[1] == 0x8B && p[2] == 0xEC) || (p[1] == 0x89 && p[2] == 0xE5))) {
+            offsets.push_back(pos >= 2 && p[-2] == 0x8B && p[-1] == 0xFF ? pos - 2 : pos);
+        } else if (reference_boundary(data, pos) && p[0] != 0xCC && p[0] != 0x90) {
+            if ((left >= 3 && p[0] == 0x83 && p[1] == 0xEC) || (left >= 6 && p[0] == 0x81 && p[1] == 0xEC)
+                || (left >= 2 && p[0] == 0x56 && p[1] == 0x57)
+                || (left >= 3 && p[0] == 0x53 && p[1] == 0x56 && p[2] == 0x57)
+                || (pos != 0 && data[pos - 1] == 0xCC && (pos & 0xF) == 0)) {
+                offsets.push_back(pos);
+            }
+        }
+    }
+}
+
+void reference_runs(const uint8_t *data, uint64_t size, uint64_t limit, uint64_t min_length, uint64_t unit,
+    std::vector<unassemblize::StringRun> &runs)
+{
+    auto printable = [&](uint64_t pos) {
+        return unassemblize::is_printable(data[pos]) && (unit == 1 || data[pos + 1] == 0);
+    };
+
+    if (unit == 2) {
+        size &= ~uint64_t(1);
+        limit &= ~uint64_t(1);
+    }
+
+    uint64_t start = 0;
+    bool active = false;
+    uint64_t pos = 0;
+
+    for (; pos + unit <= limit && (pos + unit <= size || active); pos += unit) {
+        if (printable(pos)) {
+            if (!active) {
+                start = pos;
+                active = true;
+            }
+
+            continue;
+        }
+
+        const bool terminated = data[pos] == 0 && (unit == 1 || data[pos + 1] == 0);
+
+        if (active && terminated && (pos - start) / unit >= min_length) {
+            runs.push_back({start, (pos - start) / unit, unit == 2});
+        }
+
+        active = false;
+    }
+}
+
+bool same_runs(const std::vector<unassemblize::StringRun> &a, const std::vector<unassemblize::StringRun> &b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].offset != b[i].offset || a[i].length != b[i].length || a[i].wide != b[i].wide) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool test_count_words_in_range()
+{
+    // Ranges straddling the sign bit catch a missing bias, the last one needs the high end clamped.
+    static const uint64_t ranges[][2] = {
+        {0x1000, 0x2000},
+        {0x7FFFFFF0, 0x80000010},
+        {0x80000000, 0xFFFFFFFF},
+        {0x10, 0x1FFFFFFFF},
+        {0x2000, 0x1000},
+    };
+    std::mt19937 random(s_seed);
+    std::vector<uint8_t> buffer(s_maxSize + 4);
+    bool ok = true;
+
+    for (const auto &range : ranges) {
+        const uint64_t low = range[0];
+        const uint64_t high = range[1] > UINT32_MAX ? UINT32_MAX : range[1];
+
+        for (uint64_t size = 0; size <= s_maxSize && ok; ++size) {
+            // Every word position ends the table once, including the last lane of a block and the scalar tail.
+            for (uint64_t end = 0; end <= size / 4 && ok; ++end) {
+                uint8_t *data = buffer.data() + (size & 3);
+
+                for (uint64_t word = 0; word * 4 + 4 <= size; ++word) {
+                    uint32_t value = low <= high ? uint32_t(low + random() % (high - low + 1)) : uint32_t(random());
+
+                    if (word == end) {
+                        value = low != 0 ? uint32_t(low - 1) : uint32_t(high + 1);
+                    }
+
+                    write32(data + word * 4, value);
+                }
+
+                ok = check(unassemblize::count_words_in_range(data, size, low, range[1])
+                        == reference_count_words(data, size, low, high),
+                    "count_words_in_range matches the reference");
+            }
+        }
+    }
+
+    return ok;
+}
+
+bool test_scan_pointers()
+{
+    // Bounds at the sign bit catch a missing bias, an empty range and one ending past 32 bits check the high - 1 clamp.
+    static const uint64_t ranges[][2] = {
+        {0x401000, 0x500000},
+        {0x7FFFFF00, 0x80000100},
+        {0x80000000, 0x100000000},
+        {0x10, 0x200000000},
+        {0x1000, 0x1000},
+        {0, 0},
+    };
+    std::mt19937 random(s_seed);
+    std::vector<uint8_t> buffer(s_maxSize + 4);
+    bool ok = true;
+
+    for (const auto &range : ranges) {
+        const uint32_t edges[] = {uint32_t(range[0] - 1),
+            uint32_t(range[0]),
+            uint32_t(range[1] - 1),
+            uint32_t(range[1]),
+            0,
+            UINT32_MAX,
+            0x7FFFFFFF,
+            0x80000000};
+
+        for (uint64_t size = 0; size <= s_maxSize && ok; ++size) {
+            for (uint64_t address = 0x1000; address < 0x1004 && ok; ++address) {
+                uint8_t *data = buffer.data() + (address & 3);
+                std::vector<uint64_t> expected;
+                std::vector<uint64_t> offsets;
+
+                for (uint64_t pos = 0; pos < size; ++pos) {
+                    data[pos] = uint8_t(random());
+                }
+
+                for (uint64_t pos = (4 - (address & 3)) & 3; pos + 4 <= size; pos += 4) {
+                    write32(data + pos, random() % 2 != 0 ? edges[random() % 8] : uint32_t(random()));
+                }
+
+                reference_pointers(data, size, address, range[0], range[1], expected);
+                unassemblize::scan_pointers(data, size, address, 4, range[0], range[1], offsets);
+                ok = check(offsets == expected, "scan_pointers matches the reference");
+            }
+        }
+    }
+
+    return ok;
+}
+
+bool test_scan_pattern()
+{
+    static const char *patterns[] = {".?A", "AA", "x.?Ax"};
+    const std::vector<uint8_t> alphabet = {'.', '?', 'A', 'x'};
+    std::mt19937 random(s_seed);
+    std::vector<uint8_t> buffer(s_maxSize + 4);
+    bool ok = true;
+
+    for (const char *pattern : patterns) {
+        for (uint64_t size = 0; size <= s_maxSize && ok; ++size) {
+            for (int round = 0; round < 8 && ok; ++round) {
+                uint8_t *data = buffer.data() + round % 4;
+                std::vector<uint64_t> expected;
+                std::vector<uint64_t> offsets;
+                fill_random(random, data, size, alphabet);
+                reference_pattern(data, size, pattern, strlen(pattern), expected);
+                unassemblize::scan_pattern(data, size, pattern, strlen(pattern), offsets);
+                ok = check(offsets == expected, "scan_pattern matches the reference");
+            }
+        }
+    }
+
+    return ok;
+}
+
+bool test_scan_prologues()
+{
+    const std::vector<uint8_t> alphabet = {
+        0x55, 0x8B, 0xEC, 0x89, 0xE5, 0xCC, 0x90, 0xC3, 0xC2, 0x00, 0x83, 0x81, 0x56, 0x57, 0x53, 0xFF};
+    std::mt19937 random(s_seed);
+    std::vector<uint8_t> buffer(s_maxSize + 4);
+    bool ok = true;
+
+    for (uint64_t size = 0; size <= s_maxSize && ok; ++size) {
+        for (int round = 0; round < 32 && ok; ++round) {
+            uint8_t *data = buffer.data() + round % 4;
+            std::vector<uint64_t> expected;
+            std::vector<uint64_t> offsets;
+            fill_random(random, data, size, alphabet);
+
+            // Place a prologue at position 0, in the last lane of the first block and in the scalar tail.
+            if (round % 4 == 1 && size >= 3) {
+                memcpy(data, "\x55\x8B\xEC", 3);
+            } else if (round % 4 == 2 && size >= 19) {
+                memcpy(data + 14, "\x8B\xFF\x55\x8B\xEC", 5);
+            } else if (round % 4 == 3 && size >= 3) {
+                memcpy(data + size - 3, "\x55\x89\xE5", 3);
+            }
+
+            reference_prologues(data, size, expected);
+            unassemblize::scan_prologues(data, size, offsets);
+            ok = check(offsets == expected, "scan_prologues matches the reference");
+        }
+    }
+
+    return ok;
+}
+
+bool test_scan_strings()
+{
+    const std::vector<uint8_t> alphabet = {'a', 'b', ' ', 0, 0, 0, '\t', 0x1F, 0x7F, 0x80};
+    const uint64_t max_overrun = 24;
+    std::mt19937 random(s_seed);
+    std::vector<uint8_t> buffer(s_maxSize + max_overrun + 4);
+    bool ok = true;
+
+    for (uint64_t size = 0; size <= s_maxSize && ok; ++size) {
+        for (int round = 0; round < 32 && ok; ++round) {
+            uint8_t *data = buffer.data() + round % 4;
+            const uint64_t limit = size + random() % max_overrun;
+            const uint64_t min_length = 1 + random() % 4;
+            std::vector<unassemblize::StringRun> expected;
+            std::vector<unassemblize::StringRun> runs;
+            fill_random(random, data, limit, alphabet);
+
+            // A run filling whole blocks takes the fast path, one ending past size has to continue to limit.
+            if (round % 2 == 1 && size >= 2) {
+                uint64_t start = random() % size;
+
+                for (uint64_t pos = start; pos < limit; pos += 2) {
+                    data[pos] = 'w';
+                    data[pos + 1 < limit ? pos + 1 : pos] = round % 4 == 1 ? 0 : 'w';
+                }
+            }
+
+            reference_runs(data, size, limit, min_length, 1, expected);
+            reference_runs(data, size, limit, min_length, 2, expected);
+            unassemblize::scan_strings(data, size, limit, min_length, runs);
+            ok = check(same_runs(runs, expected), "scan_strings matches the reference");
+        }
+    }
+
+    return ok;
+}
+
+// Strings crossing the 1 MiB chunks the index is built from belong to the chunk they start in, exactly once.
+bool test_string_chunks()
+{
+    const uint64_t chunk = 1024 * 1024;
+    std::vector<uint8_t> content(3 * chunk + 64, 0);
+    static const uint8_t wide[] = {'W', 0, 'I', 0, 'D', 0, 'E', 0, '!', 0};
+    memcpy(content.data() + chunk - 5, "crossing!!", 10);
+    memcpy(content.data() + 2 * chunk, "boundary", 8);
+    memcpy(content.data() + 3 * chunk - 4, wide, sizeof(wide));
+
+    const std::string path = (std::filesystem::temp_directory_path() / "unassemblize_string_chunks.elf").string();
+    const std::vector<ImageSection> sections = {{".text", FLAGS_CODE, {0xC3}}, {".data", FLAGS_DATA, content}};
+
+    if (!check(write_elf(path, sections), "writing the test image")) {
+        return false;
+    }
+
+    const uint64_t base = section_address(sections, 1);
+    unassemblize::Executable exe(path.c_str());
+    unassemblize::StringIndex index;
+    index.build(exe);
+    const unassemblize::StringIndex::Entry *crossing = index.find(base + chunk - 5);
+    const unassemblize::StringIndex::Entry *boundary = index.find(base + 2 * chunk);
+    const unassemblize::StringIndex::Entry *wide_crossing = index.find(base + 3 * chunk - 4);
+    size_t data_entries = 0;
+
+    // Section names in .shstrtab are indexed as well, only count what was found in .data.
+    for (auto it = index.entries().begin(); it != index.entries().end(); ++it) {
+        data_entries += it->address >= base && it->address < base + content.size() ? 1 : 0;
+    }
+
+    bool ok = check(data_entries == 3, "every string is indexed once")
+        && check(crossing != nullptr && index.text(*crossing) == "crossing!!" && !crossing->wide,
+            "a string crossing a chunk end is kept whole")
+        && check(boundary != nullptr && index.text(*boundary) == "boundary", "a string starting a chunk is kept")
+        && check(wide_crossing != nullptr && index.text(*wide_crossing) == "WIDE!" && wide_crossing->wide,
+            "a wide string crossing a chunk end is kept whole");
+
+    std::filesystem::remove(path);
+
+    return ok;
+}
+} // namespace
+
+int main()
+{
+    bool ok = test_count_words_in_range();
+    ok = test_scan_pointers() && ok;
+    ok = test_scan_pattern() && ok;
+    ok = test_scan_prologues() && ok;
+    ok = test_scan_strings() && ok;
+    ok = test_string_chunks() && ok;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+/**
+ * @file
+ *
+ * @brief Helpers shared by the tests, small hand made ELF images and result checks.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace unassemblize
+{
+namespace test
+{
+const uint32_t s_loadAddress = 0x8048000;
+const uint32_t s_firstSectionOffset = 0x100;
+
+enum SectionFlags : uint32_t
+{
+    FLAGS_DATA = 3, // SHF_WRITE | SHF_ALLOC
+    FLAGS_CODE = 6, // SHF_ALLOC | SHF_EXECINSTR
+};
+
+struct ImageSection
+{
+    std::string name;
+    uint32_t flags;
+    std::vector<uint8_t> content;
+};
+
+inline void put16(std::vector<uint8_t> &data, size_t offset, uint16_t value)
+{
+    data[offset] = uint8_t(value);
+    data[offset + 1] = uint8_t(value >> 8);
+}
+
+inline void put32(std::vector<uint8_t> &data, size_t offset, uint32_t value)
+{
+    put16(data, offset, uint16_t(value));
+    put16(data, offset + 2, uint16_t(value >> 16));
+}
+
+/**
+ * Address the section at index is loaded at by write_elf.
+ */
+inline uint32_t section_address(const std::vector<ImageSection> &sections, size_t index)
+{
+    uint32_t offset = s_firstSectionOffset;
+
+    for (size_t i = 0; i < index; ++i) {
+        offset = (offset + uint32_t(sections[i].content.size()) + 15) & ~15u;
+    }
+
+    return s_loadAddress + offset;
+}
+
+/**
+ * Writes a 32 bit ELF executable mapping the whole file at s_loadAddress, sections follow each other 16 byte aligned
+ * from s_firstSectionOffset. The entry point is the start of the first section.
+ */
+inline bool write_elf(const std::string &path, const std::vector<ImageSection> &sections)
+{
+    std::string names(1, '\0');
+    std::vector<uint32_t> name_offsets;
+
+    for (auto it = sections.begin(); it != sections.end(); ++it) {
+        name_offsets.push_back(uint32_t(names.size()));
+        names += it->name + '\0';
+    }
+
+    const uint32_t shstrtab_name = uint32_t(names.size());
+    names += std::string(".shstrtab") + '\0';
+    const uint32_t shstrtab_offset = section_address(sections, sections.size()) - s_loadAddress;
+    const uint32_t header_offset = (shstrtab_offset + uint32_t(names.size()) + 3) & ~3u;
+    const uint16_t section_count = uint16_t(sections.size() + 2);
+    std::vector<uint8_t> data(header_offset + section_count * 40, 0);
+
+    memcpy(data.data(), "\x7f" "ELF", 4);
+    data[4] = 1; // ELFCLASS32
+    data[5] = 1; // ELFDATA2LSB
+    data[6] = 1; // EV_CURRENT
+    put16(data, 16, 2); // ET_EXEC
+    put16(data, 18, 3); // EM_386
+    put32(data, 20, 1);
+    put32(data, 24, section_address(sections, 0));
+    put32(data, 28, 52);
+    put32(data, 32, header_offset);
+    put16(data, 40, 52);
+    put16(data, 42, 32);
+    put16(data, 44, 1);
+    put16(data, 46, 40);
+    put16(data, 48, section_count);
+    put16(data, 50, section_count - 1);
+
+    // PT_LOAD covering the whole file, readable, writable and executable.
+    put32(data, 52, 1);
+    put32(data, 56, 0);
+    put32(data, 60, s_loadAddress);
+    put32(data, 64, s_loadAddress);
+    put32(data, 68, uint32_t(data.size()));
+    put32(data, 72, uint32_t(data.size()));
+    put32(data, 76, 7);
+    put32(data, 80, 0x1000);
+
+    // SHT_PROGBITS for every section, the null section header stays zero.
+    for (size_t i = 0; i < sections.size(); ++i) {
+        const uint32_t offset = section_address(sections, i) - s_loadAddress;
+        const size_t header = header_offset + (i + 1) * 40;
+        memcpy(data.data() + offset, sections[i].content.data(), sections[i].content.size());
+        put32(data, header, name_offsets[i]);
+        put32(data, header + 4, 1);
+        put32(data, header + 8, sections[i].flags);
+        put32(data, header + 12, s_loadAddress + offset);
+        put32(data, header + 16, offset);
+        put32(data, header + 20, uint32_t(sections[i].content.size()));
+        put32(data, header + 32, 16);
+    }
+
+    // .shstrtab, SHT_STRTAB.
+    const size_t strings = header_offset + (section_count - 1) * 40;
+    memcpy(data.data() + shstrtab_offset, names.data(), names.size());
+    put32(data, strings, shstrtab_name);
+    put32(data, strings + 4, 3);
+    put32(data, strings + 16, shstrtab_offset);
+    put32(data, strings + 20, uint32_t(names.size()));
+    put32(data, strings + 32, 1);
+
+    FILE *fp = fopen(path.c_str(), "wb");
+
+    if (fp == nullptr) {
+        return false;
+    }
+
+    bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+
+    return fclose(fp) == 0 && ok;
+}
+
+inline bool check(bool condition, const char *message)
+{
+    if (!condition) {
+        printf("FAILED: %s\n", message);
+    }
+
+    return condition;
+}
+} // namespace test
+} // namespace unassemblize
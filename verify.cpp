@@ -0,0 +1,390 @@
+/**
+ * @file
+ *
+ * @brief Checks that dissassembled code reproduces the original bytes.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#include "verify.h"
+#include "executable.h"
+#include "function.h"
+#include "parallel.h"
+#include "scan.h"
+#include <LIEF/LIEF.hpp>
+#include <Zydis/Zydis.h>
+#include <algorithm>
+#include <filesystem>
+#include <inttypes.h>
+#include <map>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unordered_map>
+
+namespace
+{
+const char *find_section_name(const unassemblize::Executable &exe, uint64_t address)
+{
+    for (auto it = exe.sections().begin(); it != exe.sections().end(); ++it) {
+        if (address >= it->second.address && address < it->second.address + it->second.size) {
+            return it->first.c_str();
+        }
+    }
+
+    return nullptr;
+}
+
+// Address the assembler would give a printed name, a symbol's value or the address spelled out in a generated name.
+bool resolve_symbol(const std::unordered_map<std::string, uint64_t> &symbols, const std::string &name, uint64_t &address)
+{
+    static const char *const generated[] = {"sub_", "off_", "unk_", "loc_"};
+    auto it = symbols.find(name);
+
+    if (it != symbols.end()) {
+        address = it->second;
+        return true;
+    }
+
+    for (size_t i = 0; i < sizeof(generated) / sizeof(generated[0]); ++i) {
+        if (name.size() > 4 && name.compare(0, 4, generated[i]) == 0) {
+            char *end;
+            address = strtoull(name.c_str() + 4, &end, 16);
+            return *end == '\0';
+        }
+    }
+
+    return false;
+}
+
+void set_operand_value(ZydisEncoderOperand &operand, uint64_t value)
+{
+    switch (operand.type) {
+        case ZYDIS_OPERAND_TYPE_IMMEDIATE:
+            operand.imm.u = value;
+            break;
+        case ZYDIS_OPERAND_TYPE_MEMORY:
+            operand.mem.displacement = int64_t(value);
+            break;
+        case ZYDIS_OPERAND_TYPE_POINTER:
+            operand.ptr.offset = uint32_t(value);
+            break;
+        default:
+            break;
+    }
+}
+
+// Assembles base.S into base.o, the assembler's messages go to base.log. Returns nullptr if either step failed.
+std::unique_ptr<LIEF::Binary> assemble(const std::string &as, const char *mode, const std::string &base)
+{
+    std::string command = as + " " + mode + " -o \"" + base + ".o\" \"" + base + ".S\"";
+    command += " 2> \"" + base + ".log\"";
+
+    if (system(command.c_str()) != 0) {
+        return nullptr;
+    }
+
+    return LIEF::Parser::parse(base + ".o");
+}
+
+// Clears the mask for every byte of .text a relocation applies to, what the assembler left to the linker depends on
+// the final layout. Relocations of other sections have offsets into those and are skipped.
+void mask_relocations(const LIEF::Binary &object, std::vector<uint8_t> &mask)
+{
+    auto clear = [&mask](uint64_t address, uint64_t bits) {
+        uint64_t size = bits != 0 ? bits / 8 : sizeof(uint32_t);
+
+        for (uint64_t pos = address; pos < address + size && pos < mask.size(); ++pos) {
+            mask[pos] = 0;
+        }
+    };
+
+    if (auto elf = dynamic_cast<const LIEF::ELF::Binary *>(&object)) {
+        for (auto it = elf->relocations().begin(); it != elf->relocations().end(); ++it) {
+            if (it->section() != nullptr && it->section()->name() == ".text") {
+                clear(it->address(), it->size());
+            }
+        }
+
+        return;
+    }
+
+    for (auto it = object.relocations().begin(); it != object.relocations().end(); ++it) {
+        clear(it->address(), it->size());
+    }
+}
+} // namespace
+
+void unassemblize::verify_encoding(Executable &exe, std::vector<EncodingMismatch> &mismatches)
+{
+    const std::vector<Executable::FunctionEntry> &functions = exe.functions();
+    const bool is_64 = exe.pointer_size() == sizeof(uint64_t);
+    std::vector<std::vector<Function::OperandSymbol>> operand_symbols(functions.size());
+    std::vector<EncodingMismatch> results(functions.size());
+    std::vector<uint8_t> failed(functions.size(), 0);
+
+    // Formatting adds labels to the executable so functions are formatted one after another, only encoding is parallel.
+    for (size_t i = 0; i < functions.size(); ++i) {
+        const char *section_name = find_section_name(exe, functions[i].start);
+
+        if (section_name != nullptr && functions[i].end > functions[i].start) {
+            Function func(exe, section_name, functions[i].start, functions[i].end - 1);
+            func.disassemble(Function::FORMAT_IGAS);
+            operand_symbols[i] = func.operand_symbols();
+        }
+    }
+
+    std::unordered_map<std::string, uint64_t> symbols;
+
+    for (auto it = exe.symbols().begin(); it != exe.symbols().end(); ++it) {
+        symbols.emplace(it->second.name, it->second.value);
+    }
+
+    parallel_for(functions.size(), [&](size_t i) {
+        const Executable::FunctionEntry &func = functions[i];
+        const Executable::SectionInfo *section = exe.find_section(func.start);
+
+        if (section == nullptr || func.end > section->address + section->size) {
+            return;
+        }
+
+        ZydisDecoder decoder;
+        ZydisDecodedInstruction instruction;
+        ZydisDecodedOperand operands[ZYDIS_MAX_OPERAND_COUNT];
+        ZydisDecoderInit(&decoder,
+            is_64 ? ZYDIS_MACHINE_MODE_LONG_64 : ZYDIS_MACHINE_MODE_LEGACY_32,
+            is_64 ? ZYDIS_STACK_WIDTH_64 : ZYDIS_STACK_WIDTH_32);
+        const uint8_t *data = section->data + (func.start - section->address);
+        const uint64_t size = func.end - func.start;
+        auto symbol = operand_symbols[i].begin();
+
+        for (uint64_t offset = 0; offset < size;) {
+            // Bytes that don't decode are emitted as data by the dissassembler, nothing to re-encode.
+            if (ZYAN_FAILED(ZydisDecoderDecodeFull(&decoder, data + offset, size - offset, &instruction, operands))) {
+                ++offset;
+                continue;
+            }
+
+            const uint64_t address = func.start + offset;
+            ZydisEncoderRequest request;
+            uint8_t encoded[ZYDIS_MAX_INSTRUCTION_LENGTH];
+            ZyanUSize length = sizeof(encoded);
+            bool ok = ZYAN_SUCCESS(ZydisEncoderDecodedInstructionToEncoderRequest(
+                &instruction, operands, instruction.operand_count_visible, &request));
+
+            // The encoder takes absolute targets, so relative operands are converted before any printed name
+            // replaces its operand with the address that name resolves to.
+            for (uint8_t op = 0; ok && op < instruction.operand_count_visible; ++op) {
+                const ZydisDecodedOperand &operand = operands[op];
+                uint64_t target;
+
+                if ((operand.type == ZYDIS_OPERAND_TYPE_IMMEDIATE && operand.imm.is_relative)
+                    || (operand.type == ZYDIS_OPERAND_TYPE_MEMORY
+                        && (operand.mem.base == ZYDIS_REGISTER_RIP || operand.mem.base == ZYDIS_REGISTER_EIP))) {
+                    ok = ZYAN_SUCCESS(ZydisCalcAbsoluteAddress(&instruction, &operand, address, &target));
+                    set_operand_value(request.operands[op], target);
+                }
+            }
+
+            while (symbol != operand_symbols[i].end() && symbol->address < address) {
+                ++symbol;
+            }
+
+            for (; symbol != operand_symbols[i].end() && symbol->address == address; ++symbol) {
+                uint64_t value;
+                ok = ok && symbol->operand < request.operand_count && resolve_symbol(symbols, symbol->name, value);
+
+                if (ok) {
+                    set_operand_value(request.operands[symbol->operand], value + symbol->addend);
+                }
+            }
+
+            ok = ok && ZYAN_SUCCESS(ZydisEncoderEncodeInstructionAbsolute(&request, encoded, &length, address));
+
+            if (!ok || length != instruction.length || memcmp(encoded, data + offset, length) != 0) {
+                EncodingMismatch &mismatch = results[i];
+                mismatch.function = func.start;
+                mismatch.address = address;
+                mismatch.original_length = instruction.length;
+                mismatch.encoded_length = ok ? uint8_t(length) : 0;
+                memcpy(mismatch.original, data + offset, instruction.length);
+                memcpy(mismatch.encoded, encoded, ok ? length : 0);
+                failed[i] = 1;
+                return;
+            }
+
+            offset += instruction.length;
+
+            // Step over inline jump tables the same way Function::disassemble does.
+            if (instruction.mnemonic == ZYDIS_MNEMONIC_NOP || instruction.mnemonic == ZYDIS_MNEMONIC_JMP) {
+                offset += sizeof(uint32_t) * count_words_in_range(data + offset, size - offset, func.start, func.end - 1);
+            }
+        }
+    });
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (failed[i]) {
+            mismatches.push_back(results[i]);
+        }
+    }
+}
+
+void unassemblize::verify_assembly(
+    Executable &exe, const char *section_name, const char *directory, std::vector<AssemblyMismatch> &mismatches)
+{
+    const uint64_t section_start = exe.section_address(section_name);
+    const uint64_t section_end = section_start + exe.section_size(section_name);
+    std::vector<Executable::FunctionEntry> functions;
+
+    for (auto it = exe.functions().begin(); it != exe.functions().end(); ++it) {
+        if (it->start >= section_start && it->end <= section_end) {
+            functions.push_back(*it);
+        }
+    }
+
+    if (functions.empty()) {
+        return;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+
+    // Objects are never split so a shard is a set of whole objects, small ones are batched up to a share of the
+    // functions that keeps a few shards per core. A large object still gets a shard of its own.
+    const size_t target = std::max<size_t>(1, functions.size() / (std::max(1u, std::thread::hardware_concurrency()) * 4));
+    std::map<std::string, std::vector<size_t>> objects;
+    std::vector<std::vector<size_t>> shards(1);
+
+    for (size_t i = 0; i < functions.size(); ++i) {
+        objects[exe.object_name(section_name, functions[i].start)].push_back(i);
+    }
+
+    for (auto it = objects.begin(); it != objects.end(); ++it) {
+        if (shards.back().size() >= target) {
+            shards.emplace_back();
+        }
+
+        shards.back().insert(shards.back().end(), it->second.begin(), it->second.end());
+    }
+
+    static const char header[] = ".intel_syntax noprefix\n\n";
+    std::vector<std::string> names(functions.size());
+    std::vector<std::string> texts(functions.size());
+
+    // Formatting adds symbols to the executable so it happens in order, the text of each function is kept in case its
+    // shard has to be split up.
+    for (size_t shard = 0; shard < shards.size(); ++shard) {
+        std::string path = std::string(directory) + "/shard" + std::to_string(shard) + ".S";
+        FILE *fp = fopen(path.c_str(), "wb");
+
+        if (fp == nullptr) {
+            continue;
+        }
+
+        fputs(header, fp);
+
+        for (auto it = shards[shard].begin(); it != shards[shard].end(); ++it) {
+            const size_t i = *it;
+            texts[i] = exe.function_text(section_name, functions[i].start, functions[i].end - 1) + "\n";
+            fputs(texts[i].c_str(), fp);
+            char buffer[32];
+            const std::string &name = exe.get_symbol(functions[i].start).name;
+            snprintf(buffer, sizeof(buffer), "sub_%" PRIx64, functions[i].start);
+            names[i] = name.empty() ? buffer : name;
+        }
+
+        fclose(fp);
+    }
+
+    const std::string as = getenv("AS") != nullptr ? getenv("AS") : "as";
+    const char *mode = exe.pointer_size() == sizeof(uint64_t) ? "--64" : "--32";
+    const uint8_t *section_data = exe.section_data(section_name);
+    std::vector<AssemblyMismatch> results(functions.size(), {0, 0});
+    std::vector<uint8_t> failed(functions.size(), 0);
+
+    // Compares the functions with the assembled text of the object, false if the object has no text section.
+    auto compare = [&](const LIEF::Binary *object, const size_t *first, const size_t *last) {
+        const LIEF::Section *text = nullptr;
+
+        for (auto it = object->sections().begin(); it != object->sections().end(); ++it) {
+            if (it->name() == ".text") {
+                text = &*it;
+            }
+        }
+
+        if (text == nullptr) {
+            return false;
+        }
+
+        const uint8_t *assembled = text->content().data();
+        const uint64_t assembled_size = text->content().size();
+        std::vector<uint8_t> mask(assembled_size, 0xFF);
+        std::unordered_map<std::string, uint64_t> symbols;
+        mask_relocations(*object, mask);
+
+        for (auto it = object->symbols().begin(); it != object->symbols().end(); ++it) {
+            symbols.emplace(it->name(), it->value());
+        }
+
+        for (const size_t *i = first; i != last; ++i) {
+            const uint8_t *original = section_data + (functions[*i].start - section_start);
+            const uint64_t size = functions[*i].end - functions[*i].start;
+            auto symbol = symbols.find(names[*i]);
+            uint64_t position = symbol != symbols.end() ? symbol->second : assembled_size;
+            uint64_t compared = position < assembled_size ? std::min(size, assembled_size - position) : 0;
+            uint64_t offset = 0;
+
+            while (offset < compared && ((original[offset] ^ assembled[position + offset]) & mask[position + offset]) == 0) {
+                ++offset;
+            }
+
+            if (offset != size) {
+                results[*i] = {functions[*i].start, offset};
+                failed[*i] = 1;
+            }
+        }
+
+        return true;
+    };
+
+    parallel_for(shards.size(), [&](size_t shard) {
+        const std::vector<size_t> &members = shards[shard];
+        std::string base = std::string(directory) + "/shard" + std::to_string(shard);
+        std::unique_ptr<LIEF::Binary> object = assemble(as, mode, base);
+
+        if (object != nullptr && compare(object.get(), members.data(), members.data() + members.size())) {
+            return;
+        }
+
+        // One function the assembler rejects fails its whole shard, each is assembled alone to find which.
+        for (size_t j = 0; j < members.size(); ++j) {
+            const size_t i = members[j];
+            std::string single = base + "_" + std::to_string(j);
+            FILE *fp = fopen((single + ".S").c_str(), "wb");
+            bool written = fp != nullptr && fputs(header, fp) >= 0 && fputs(texts[i].c_str(), fp) >= 0;
+
+            if (fp != nullptr && fclose(fp) != 0) {
+                written = false;
+            }
+
+            object = written ? assemble(as, mode, single) : nullptr;
+
+            if (object == nullptr || !compare(object.get(), &i, &i + 1)) {
+                results[i] = {functions[i].start, UINT64_MAX};
+                failed[i] = 1;
+            }
+        }
+    });
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (failed[i]) {
+            mismatches.push_back(results[i]);
+        }
+    }
+}
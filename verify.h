@@ -0,0 +1,54 @@
+/**
+ * @file
+ *
+ * @brief Checks that dissassembled code reproduces the original bytes.
+ *
+ * @copyright Assemblize is free software: you can redistribute it and/or
+ *            modify it under the terms of the GNU General Public License
+ *            as published by the Free Software Foundation, either version
+ *            3 of the License, or (at your option) any later version.
+ *            A full copy of the GNU General Public License can be found in
+ *            LICENSE
+ */
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+namespace unassemblize
+{
+class Executable;
+
+struct EncodingMismatch
+{
+    uint64_t function; // Start of the function.
+    uint64_t address; // First instruction that didn't encode back to its original bytes.
+    uint8_t original[15];
+    uint8_t encoded[15];
+    uint8_t original_length;
+    uint8_t encoded_length; // 0 if the encoder rejected the instruction.
+};
+
+/**
+ * Formats every function in the function table, then re-encodes each decoded instruction at its original address with
+ * the operands printed as symbols replaced by the addresses those names resolve to, and compares the result with the
+ * original bytes. Encoding runs in parallel. Reports the first mismatch per function, a name that doesn't resolve
+ * counts as an instruction the encoder rejected.
+ */
+void verify_encoding(Executable &exe, std::vector<EncodingMismatch> &mismatches);
+
+struct AssemblyMismatch
+{
+    uint64_t function; // Start of the function.
+    uint64_t offset; // Offset of the first differing byte, UINT64_MAX if the function didn't assemble.
+};
+
+/**
+ * Dissassembles the functions of a section into shards of whole objects in directory, assembles the shards with GNU
+ * as in parallel and compares the assembled bytes of each function with the original ones, bytes covered by
+ * relocations of the text sections are ignored. Functions of a shard that doesn't assemble are assembled one at a
+ * time. The assembler can be overridden with the AS environment variable.
+ */
+void verify_assembly(
+    Executable &exe, const char *section_name, const char *directory, std::vector<AssemblyMismatch> &mismatches);
+} // namespace unassemblize